@@ -25,7 +25,24 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace linq
@@ -46,6 +63,19 @@ namespace linq
         descending
     };
 
+    /**
+     * Execution policy that requests parallel execution on all hardware threads.
+     */
+    struct parallel_policy
+    {
+        /* Nothing to define here. */
+    };
+
+    /**
+     * Passed to operators that support parallel execution, e.g. order_by(keySelector, sortDir, linq::par).
+     */
+    static const parallel_policy par = parallel_policy();
+
     namespace details
     {
         // ----------------------------------
@@ -58,6 +88,18 @@ namespace linq
         template<typename TPrevRange>
         class distinct_range;
 
+        template<typename TPrevRange, typename TKeySelector>
+        class distinct_by_range;
+
+        template<typename TPrevRange, typename TOtherRange>
+        class union_range;
+
+        template<typename TPrevRange, typename TOtherRange>
+        class intersect_range;
+
+        template<typename TPrevRange, typename TOtherRange>
+        class except_range;
+
         template<typename TPrevRange, typename TTransform>
         class select_range;
 
@@ -79,6 +121,12 @@ namespace linq
         template<typename TPrevRange, typename TPredicate>
         class skip_while_range;
 
+        template<typename TPrevRange>
+        class chunk_range;
+
+        template<typename TPrevRange>
+        class buffered_range;
+
         template<typename TPrevRange, typename TOtherRange>
         class append_range;
 
@@ -92,26 +140,54 @@ namespace linq
         >
         class join_range;
 
+        template<
+            typename TPrevRange, typename TOtherRange,
+            typename TKeySelectorA, typename TKeySelectorB,
+            typename TTransform
+        >
+        class merge_join_range;
+
         template<typename TPrevRange, typename TKeySelector>
         class order_by_range;
 
         template<typename TPrevRange, typename TKeySelector>
         class then_by_range;
 
+        template<typename TPrevRange, typename TKeySelector>
+        class order_by_external_range;
+
+        template<typename TPrevRange, typename TKeySelector>
+        struct group_by_traits;
+
+        template<typename TPrevRange, typename TKeySelector>
+        class group_by_range;
+
+        template<
+            typename TPrevRange, typename TKeySelector,
+            typename TAccumulate, typename TAccumFunc,
+            bool HasSeed
+        >
+        class group_aggregate_range;
+
+        template<typename TContainer>
+        class from_container_range;
+
+        template<typename TRange>
+        class parallel_range;
+
         // ----------------------------------
         // Average calculators
         // ----------------------------------
 
-        // Calculates the average of a specific range.
+        // Calculates the average of a specific range from the sum and number of its elements.
         template<typename TRange, typename TInput>
         struct avg_calculator
         {
             using output_t = TInput;
 
-            output_t calc(const TRange& op) const
+            output_t calc(const TInput& sum, size_t count) const
             {
-                size_t count = op.count();
-                return (count > 0) ? (op.sum() / count) : output_t();
+                return (count > 0) ? (sum / count) : output_t();
             }
         };
 
@@ -120,12 +196,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(short sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -135,12 +209,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(int sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -150,12 +222,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(long sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -165,12 +235,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(long long sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -180,12 +248,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(unsigned short sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -195,12 +261,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(unsigned int sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -210,12 +274,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(unsigned long sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -225,12 +287,10 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(unsigned long long sum, size_t count) const
             {
-                size_t count = op.count();
-
                 return (count > 0) ?
-                    (static_cast<double>(op.sum()) / count) :
+                    (static_cast<double>(sum) / count) :
                     0.0;
             }
         };
@@ -240,10 +300,9 @@ namespace linq
         {
             using output_t = float;
 
-            output_t calc(const TRange& op) const
+            output_t calc(float sum, size_t count) const
             {
-                size_t count = op.count();
-                return (count > 0) ? op.sum() / count : 0.0f;
+                return (count > 0) ? sum / count : 0.0f;
             }
         };
 
@@ -252,936 +311,4786 @@ namespace linq
         {
             using output_t = double;
 
-            output_t calc(const TRange& op) const
+            output_t calc(double sum, size_t count) const
             {
-                size_t count = op.count();
-                return (count > 0) ? op.sum() / count : 0.0;
+                return (count > 0) ? sum / count : 0.0;
             }
         };
 
-        // ----------------------------------
-        // base_range
-        // ----------------------------------
-
-        // Base class to identify ALL range types (for compile-time type checking).
-        class base_range_ident
+        // The aggregates of a range that stats() computes in one pass.
+        // Sum, Min and Max are default values for an empty range.
+        template<typename T, typename TMean>
+        struct range_stats
         {
-            /* Nothing to define here. */
+            size_t Count;
+            T Sum;
+            T Min;
+            T Max;
+            TMean Mean;
         };
 
-        // Base class for sorting ranges (for compile-time type checking).
-        class sorting_range
-        {
-            /* Nothing to define here. */
-        };
+        // ----------------------------------
+        // Parallel execution
+        // ----------------------------------
 
-        /**
-        * Base class of all LINQ ranges.
-        */
-        template<
-            typename TMy,       // The fully qualified type of this range.
-            typename TOutput    // The full, unmodified type that is returned by this range.
-        >
-        class base_range : public base_range_ident
+        // Returns the number of threads that parallel operations use.
+        inline size_t hardware_thread_count()
         {
-        private:
-            // Return non-const, non-volatile, non-reference types from methods such as sum, min and max.
-            using output_t = typename std::decay<TOutput>::type;
-
-        public:
-            template<typename TPredicate>
-            where_range<TMy, TPredicate> where(const TPredicate& predicate) const;
-
-            distinct_range<TMy> distinct() const;
-
-            template<typename TTransform>
-            select_range<TMy, TTransform> select(const TTransform& transform) const;
+            const unsigned count = std::thread::hardware_concurrency();
+            return (count > 0) ? count : 1;
+        }
 
-            template<typename TTransform>
-            select_many_range<TMy, TTransform> select_many(const TTransform& transform) const;
+        // Calls func(i) for every i in [0, taskCount) on up to hardware_thread_count() threads,
+        // including the calling one. Tasks are handed out one by one, so that threads which
+        // finish early pick up the remaining ones. Returns after all tasks are finished.
+        template<typename TFunc>
+        void parallel_for(size_t taskCount, const TFunc& func)
+        {
+            const size_t threadCount = (std::min)(taskCount, hardware_thread_count());
 
-            reverse_range<TMy> reverse() const;
+            if (threadCount <= 1)
+            {
+                for (size_t i = 0; i < taskCount; ++i)
+                    func(i);
 
-            take_range<TMy> take(size_t count) const;
+                return;
+            }
 
-            template<typename TPredicate>
-            take_while_range<TMy, TPredicate> take_while(const TPredicate& predicate) const;
+            std::atomic<size_t> nextTask(0);
 
-            skip_range<TMy> skip(size_t count) const;
+            auto work = [&]()
+            {
+                for (size_t i = nextTask++; i < taskCount; i = nextTask++)
+                    func(i);
+            };
 
-            template<typename TPredicate>
-            skip_while_range<TMy, TPredicate> skip_while(const TPredicate& predicate) const;
+            std::vector<std::thread> threads;
+            threads.reserve(threadCount - 1);
 
-            template<typename TOtherRange>
-            append_range<TMy, TOtherRange> append(const TOtherRange& otherRange) const;
+            for (size_t i = 0; i < threadCount - 1; ++i)
+                threads.emplace_back(work);
 
-            repeat_range<TMy> repeat(size_t count) const;
+            work();
 
-            template<typename TOtherRange, typename TKeySelectorA, typename TKeySelectorB, typename TTransform>
-            join_range<TMy, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform> join(
-                const TOtherRange& otherRange,
-                const TKeySelectorA& keySelectorA,
-                const TKeySelectorB& keySelectorB,
-                const TTransform& transform
-                ) const;
+            for (auto& t : threads)
+                t.join();
+        }
 
-            template<typename TKeySelector>
-            order_by_range<TMy, TKeySelector> order_by(const TKeySelector& keySelector, sort_direction sortDir) const;
+        // Calls func(first, last) for blocks of up to grain indices of [0, count), on up to
+        // hardware_thread_count() threads. Every thread starts with an equal share of the indices
+        // and takes blocks from the front of it. Threads that run out of work steal the back half
+        // of what is left of another share. func returns false to cancel the blocks that were
+        // not started yet. Returns after all started blocks are finished.
+        template<typename TFunc>
+        void work_stealing_for(size_t count, size_t grain, const TFunc& func)
+        {
+            const size_t workerCount = (std::min)(hardware_thread_count(), (count + grain - 1) / grain);
 
-            template<typename TKeySelector>
-            inline order_by_range<TMy, TKeySelector> order_by_ascending(const TKeySelector& keySelector) const
+            if (workerCount <= 1)
             {
-                return order_by<TKeySelector>(keySelector, linq::sort_direction::ascending);
+                for (size_t first = 0; first < count; first += grain)
+                    if (!func(first, (std::min)(first + grain, count)))
+                        return;
+
+                return;
             }
 
-            template<typename TKeySelector>
-            inline order_by_range<TMy, TKeySelector> order_by_descending(const TKeySelector& keySelector) const
+            struct share
             {
-                return order_by<TKeySelector>(keySelector, linq::sort_direction::descending);
-            }
+                std::mutex Lock;
+                size_t Begin;
+                size_t End;
+            };
 
-            template<typename TKeySelector>
-            then_by_range<TMy, TKeySelector> then_by(const TKeySelector& keySelector, sort_direction sortDir) const;
+            std::unique_ptr<share[]> shares(new share[workerCount]);
+            std::atomic<bool> cancelled(false);
 
-            template<typename TKeySelector>
-            inline then_by_range<TMy, TKeySelector> then_by_ascending(const TKeySelector& keySelector) const
+            for (size_t w = 0; w < workerCount; ++w)
             {
-                return then_by<TKeySelector>(keySelector, linq::sort_direction::ascending);
+                shares[w].Begin = count * w / workerCount;
+                shares[w].End = count * (w + 1) / workerCount;
             }
 
-            template<typename TKeySelector>
-            inline then_by_range<TMy, TKeySelector> then_by_descending(const TKeySelector& keySelector) const
+            // Moves the back half of another share into the empty share of worker w.
+            auto steal = [&](size_t w) -> bool
             {
-                return then_by<TKeySelector>(keySelector, linq::sort_direction::descending);
-            }
+                for (size_t k = 1; k < workerCount; ++k)
+                {
+                    share& victim = shares[(w + k) % workerCount];
+                    size_t first = 0, last = 0;
 
-            output_t sum() const;
-            output_t min() const;
-            output_t max() const;
+                    {
+                        std::lock_guard<std::mutex> lock(victim.Lock);
+                        const size_t remaining = victim.End - victim.Begin;
 
-            typename avg_calculator<TMy, output_t>::output_t average() const;
+                        if (remaining == 0)
+                            continue;
 
-            template<typename TAccumFunc>
-            output_t aggregate(const TAccumFunc& func) const;
+                        last = victim.End;
+                        first = last - (remaining + 1) / 2;
+                        victim.End = first;
+                    }
 
-            output_t first(const output_t& defaultValue = output_t()) const;
+                    std::lock_guard<std::mutex> lock(shares[w].Lock);
+                    shares[w].Begin = first;
+                    shares[w].End = last;
+                    return true;
+                }
 
-            template<typename TPredicate>
-            output_t first(const TPredicate& predicate, const output_t& defaultValue = output_t()) const;
+                return false;
+            };
 
-            output_t last(const output_t& defaultValue = output_t()) const;
+            auto work = [&](size_t w)
+            {
+                share& own = shares[w];
 
-            template<typename TPredicate>
-            output_t last(const TPredicate& predicate, const output_t& defaultValue = output_t()) const;
+                while (!cancelled.load(std::memory_order_relaxed))
+                {
+                    size_t first = 0, last = 0;
 
-            template<typename TPredicate>
-            bool any(const TPredicate& predicate) const;
+                    {
+                        std::lock_guard<std::mutex> lock(own.Lock);
+                        first = own.Begin;
+                        last = (std::min)(first + grain, own.End);
+                        own.Begin = last;
+                    }
 
-            template<typename TPredicate>
-            bool all(const TPredicate& predicate) const;
+                    if (first == last)
+                    {
+                        if (!steal(w))
+                            return;
+                    }
+                    else if (!func(first, last))
+                        cancelled = true;
+                }
+            };
 
-            size_t count() const;
+            std::vector<std::thread> threads;
+            threads.reserve(workerCount - 1);
 
-            template<typename TPredicate>
-            size_t count(const TPredicate& predicate) const;
+            for (size_t w = 1; w < workerCount; ++w)
+                threads.emplace_back(work, w);
 
-            output_t element_at(size_t index, const output_t& defaultValue = output_t()) const;
+            work(0);
 
-            std::vector<output_t> to_vector() const;
-        };
+            for (auto& t : threads)
+                t.join();
+        }
 
         // ----------------------------------
-        // where
+        // hash_table
         // ----------------------------------
 
-        template<typename TPrevRange, typename TPredicate>
-        class where_range : public base_range<
-            where_range<TPrevRange, TPredicate>,
-            typename TPrevRange::iterator::output_t
-        >
+        // Determines whether std::hash is available for a type (for compile-time dispatch).
+        template<typename T, typename = void>
+        struct is_hashable : public std::false_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename T>
+        struct is_hashable<T, decltype(void(std::hash<T>()(std::declval<const T&>())))>
+            : public std::true_type
+        {
+            /* Nothing to define here. */
+        };
+
+        // Open addressing hash table with linear probing.
+        // Entries are stored densely in insertion order, while the probed slots
+        // only hold indices into them. Every entry caches the hash of its key,
+        // so that a key is hashed once and growing never calls the hash function.
+        template<typename TKey, typename TValue>
+        class hash_table
         {
         public:
-            struct iterator
+            struct entry
             {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = typename prev_iter_t::output_t;
+                size_t Hash;
+                TKey Key;
+                TValue Value;
+            };
 
-                iterator() = default;
+            using entry_container = std::vector<entry>;
 
-                iterator(const where_range* parent, prev_iter_t begin, prev_iter_t end)
-                    : Parent(parent)
-                    , Begin(begin)
-                    , End(end)
+            // Hashes a key and scrambles the result, because std::hash is
+            // the identity function for integers in most implementations.
+            static size_t hash_of(const TKey& key)
+            {
+                unsigned long long h = static_cast<unsigned long long>(std::hash<TKey>()(key));
+
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdULL;
+                h ^= h >> 33;
+                h *= 0xc4ceb9fe1a85ec53ULL;
+                h ^= h >> 33;
+
+                return static_cast<size_t>(h);
+            }
+
+            // Returns the entry of a key, or nullptr if the key is not in the table.
+            const entry* find(const TKey& key, size_t hash) const
+            {
+                if (Slots.empty())
+                    return nullptr;
+
+                const size_t mask = Slots.size() - 1;
+
+                for (size_t pos = hash & mask; Slots[pos] != 0; pos = (pos + 1) & mask)
                 {
-                    const auto& pred = *Parent->Predicate;
+                    const entry& e = Entries[Slots[pos] - 1];
 
-                    // Seek the first match.
-                    while (Begin != End && !pred(*Begin))
-                        ++Begin;
+                    if (e.Hash == hash && e.Key == key)
+                        return &e;
                 }
 
-                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
-                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+                return nullptr;
+            }
 
-                inline iterator& operator++()
-                {
-                    const auto& pred = *Parent->Predicate;
+            inline entry* find(const TKey& key, size_t hash)
+            {
+                return const_cast<entry*>(static_cast<const hash_table*>(this)->find(key, hash));
+            }
 
-                    do
-                    {
-                        ++Begin;
-                    } while (Begin != End && !pred(*Begin));
+            // Inserts a key with a value, unless the key is already in the table.
+            // Returns the entry of the key and whether it was inserted.
+            // The returned entry is only valid until the next insertion.
+            std::pair<entry*, bool> insert(const TKey& key, size_t hash, const TValue& value)
+            {
+                if ((Entries.size() + 1) * 2 > Slots.size())
+                    rehash((Slots.size() < 16) ? 16 : Slots.size() * 2);
 
-                    return *this;
-                }
+                const size_t mask = Slots.size() - 1;
+                size_t pos = hash & mask;
 
-                inline output_t operator*() const { return *Begin; }
+                for (; Slots[pos] != 0; pos = (pos + 1) & mask)
+                {
+                    entry& e = Entries[Slots[pos] - 1];
 
-                const where_range* Parent;
-                prev_iter_t Begin;
-                prev_iter_t End;
-            };
+                    if (e.Hash == hash && e.Key == key)
+                        return std::make_pair(&e, false);
+                }
 
-        public:
-            where_range() = default;
+                Entries.push_back(entry{ hash, key, value });
+                Slots[pos] = Entries.size();
 
-            where_range(const TPrevRange& prev, const TPredicate& predicate)
-                : Prev(prev)
-                , Predicate(&predicate)
-            {}
+                return std::make_pair(&Entries.back(), true);
+            }
 
-            inline iterator begin() const
+            // Prepares the table for a number of entries, so that inserting them does not rehash.
+            void reserve(size_t count)
             {
-                return iterator(this, Prev.begin(), Prev.end());
+                size_t slotCount = 16;
+                while (slotCount < count * 2)
+                    slotCount *= 2;
+
+                Entries.reserve(count);
+
+                if (slotCount > Slots.size())
+                    rehash(slotCount);
             }
 
-            inline iterator end() const
+            // Removes all entries, but keeps the allocated memory for reuse.
+            void clear()
             {
-                return iterator(this, Prev.end(), Prev.end());
+                Entries.clear();
+                std::fill(Slots.begin(), Slots.end(), 0);
             }
 
-        private:
-            TPrevRange Prev;
-            const TPredicate* Predicate;
-        };
+            inline size_t size() const { return Entries.size(); }
 
-        // ----------------------------------
-        // distinct
-        // ----------------------------------
+            inline const entry_container& entries() const { return Entries; }
 
-        template<typename TPrevRange>
-        class distinct_range : public base_range<
-            distinct_range<TPrevRange>,
-            typename TPrevRange::iterator::output_t
-        >
-        {
         private:
-            using prev_iter_t = typename TPrevRange::iterator;
-            using object_container = std::vector<prev_iter_t>;
-
-        public:
-            struct iterator
+            void rehash(size_t slotCount)
             {
-                using output_t = typename prev_iter_t::output_t;
+                const size_t mask = slotCount - 1;
 
-                iterator() = default;
+                Slots.assign(slotCount, 0);
+
+                for (size_t i = 0; i < Entries.size(); ++i)
+                {
+                    size_t pos = Entries[i].Hash & mask;
+                    while (Slots[pos] != 0)
+                        pos = (pos + 1) & mask;
+
+                    Slots[pos] = i + 1;
+                }
+            }
+
+            entry_container Entries;
+
+            // Index + 1 of an entry, 0 for empty slots. The size is always a power of two.
+            std::vector<size_t> Slots;
+        };
+
+        // Set of unique values, backed by a hash_table.
+        template<typename T>
+        class hash_set
+        {
+        public:
+            // Inserts a value and returns whether it was not in the set yet.
+            inline bool insert(const T& value)
+            {
+                return Table.insert(value, table_t::hash_of(value), no_value()).second;
+            }
+
+            inline bool contains(const T& value) const
+            {
+                return Table.find(value, table_t::hash_of(value)) != nullptr;
+            }
+
+            inline void reserve(size_t count) { Table.reserve(count); }
+            inline void clear() { Table.clear(); }
+            inline size_t size() const { return Table.size(); }
+
+        private:
+            struct no_value
+            {
+                /* Nothing to define here. */
+            };
+
+            using table_t = hash_table<T, no_value>;
+
+            table_t Table;
+        };
+
+        // ----------------------------------
+        // Iterator categories
+        // ----------------------------------
+
+        // Range iterators are forward iterators, unless they define a category typedef.
+        // Bidirectional iterators additionally provide operator--, random access iterators
+        // also provide operator+=, operator- (the distance) and operator[].
+        template<typename TIter, typename = void>
+        struct iterator_category
+        {
+            using type = std::forward_iterator_tag;
+        };
+
+        template<typename TIter>
+        struct iterator_category<TIter, decltype(void(std::declval<typename TIter::category>()))>
+        {
+            using type = typename TIter::category;
+        };
+
+        template<typename TIter>
+        struct is_bidirectional_iterator : public std::is_base_of<
+            std::bidirectional_iterator_tag,
+            typename iterator_category<TIter>::type
+        >
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TIter>
+        struct is_random_access_iterator : public std::is_base_of<
+            std::random_access_iterator_tag,
+            typename iterator_category<TIter>::type
+        >
+        {
+            /* Nothing to define here. */
+        };
+
+        // Maps a standard iterator category to the categories supported by range iterators.
+        template<typename TTag>
+        using range_category_t = typename std::conditional<
+            std::is_base_of<std::random_access_iterator_tag, TTag>::value,
+            std::random_access_iterator_tag,
+            typename std::conditional<
+                std::is_base_of<std::bidirectional_iterator_tag, TTag>::value,
+                std::bidirectional_iterator_tag,
+                std::forward_iterator_tag
+            >::type
+        >::type;
+
+        // The category of a range iterator that wraps an iterator of a different category.
+        template<typename TIter>
+        using inherited_category_t = range_category_t<typename iterator_category<TIter>::type>;
+
+        // Counts the elements between two range iterators.
+        template<typename TIter>
+        inline size_t iterator_distance(const TIter& begin, const TIter& end, std::true_type)
+        {
+            return static_cast<size_t>(end - begin);
+        }
+
+        template<typename TIter>
+        inline size_t iterator_distance(TIter begin, const TIter& end, std::false_type)
+        {
+            size_t count = 0;
+
+            for (; begin != end; ++begin)
+                ++count;
+
+            return count;
+        }
+
+        template<typename TIter>
+        inline size_t iterator_distance(const TIter& begin, const TIter& end)
+        {
+            return iterator_distance(begin, end, is_random_access_iterator<TIter>());
+        }
+
+        // Advances a range iterator by up to count elements, stopping at end.
+        template<typename TIter>
+        inline void iterator_advance(TIter& pos, const TIter& end, size_t count, std::true_type)
+        {
+            pos += static_cast<std::ptrdiff_t>((std::min)(count, static_cast<size_t>(end - pos)));
+        }
+
+        template<typename TIter>
+        inline void iterator_advance(TIter& pos, const TIter& end, size_t count, std::false_type)
+        {
+            for (; pos != end && count > 0; --count)
+                ++pos;
+        }
+
+        template<typename TIter>
+        inline void iterator_advance(TIter& pos, const TIter& end, size_t count)
+        {
+            iterator_advance(pos, end, count, is_random_access_iterator<TIter>());
+        }
+
+        // ----------------------------------
+        // Size hints
+        // ----------------------------------
+
+        // The number of elements of a range as far as it is known without iterating it:
+        // either the exact size, or an upper bound (which is the maximum if nothing is known).
+        struct range_size
+        {
+            range_size(size_t size, bool isExact)
+                : Size(size)
+                , IsExact(isExact)
+            {}
+
+            static inline range_size unknown() { return range_size(std::numeric_limits<size_t>::max(), false); }
+            static inline range_size at_most(size_t size) { return range_size(size, false); }
+
+            inline range_size operator+(const range_size& o) const
+            {
+                const size_t sum = Size + o.Size;
+                return (sum < Size) ? unknown() : range_size(sum, IsExact && o.IsExact);
+            }
+
+            inline range_size operator*(size_t count) const
+            {
+                if (count != 0 && Size > std::numeric_limits<size_t>::max() / count)
+                    return unknown();
+
+                return range_size(Size * count, IsExact);
+            }
+
+            size_t Size;
+            bool IsExact;
+        };
+
+        // Containers report their size, unless they can't do it (such as std::forward_list).
+        template<typename TContainer>
+        inline range_size container_size(const TContainer&, long)
+        {
+            return range_size::unknown();
+        }
+
+        template<typename TContainer>
+        inline auto container_size(const TContainer& container, int)
+            -> decltype(container.size(), range_size(0, true))
+        {
+            return range_size(container.size(), true);
+        }
+
+        // ----------------------------------
+        // SIMD reductions
+        // ----------------------------------
+
+        enum class simd_op
+        {
+            sum,
+            min,
+            max
+        };
+
+        // Combines a value with an accumulated result, like the scalar loops of sum(), min() and max().
+        template<simd_op Op, typename T>
+        inline T simd_combine(const T& value, const T& acc)
+        {
+            return (Op == simd_op::sum) ? (value + acc) :
+                (Op == simd_op::min) ? ((value < acc) ? value : acc) :
+                ((acc < value) ? value : acc);
+        }
+
+        // The kernels use the vector extensions of GCC and Clang, which compile to SSE2 by default
+        // on x86. CPUs that support AVX2 run a second instantiation that is compiled for it.
+        // Define LINQ_NO_SIMD to always use the scalar loops.
+#if !defined(LINQ_NO_SIMD) && (defined(__GNUC__) || defined(__clang__))
+
+        template<typename T>
+        struct simd_vector;
+
+        template<>
+        struct simd_vector<int>
+        {
+            typedef int type __attribute__((vector_size(32)));
+            typedef int mask_t __attribute__((vector_size(32)));
+        };
+
+        template<>
+        struct simd_vector<float>
+        {
+            typedef float type __attribute__((vector_size(32)));
+            typedef int mask_t __attribute__((vector_size(32)));
+        };
+
+        template<>
+        struct simd_vector<double>
+        {
+            typedef double type __attribute__((vector_size(32)));
+            typedef long long mask_t __attribute__((vector_size(32)));
+        };
+
+        template<typename T>
+        struct is_simd_element : public std::integral_constant<bool,
+            std::is_same<T, int>::value ||
+            std::is_same<T, float>::value ||
+            std::is_same<T, double>::value
+        >
+        {
+            /* Nothing to define here. */
+        };
+
+        template<simd_op Op, typename TVector, typename TMask>
+        __attribute__((always_inline)) inline void simd_combine_vector(const TVector& values, TVector& acc)
+        {
+            if (Op == simd_op::sum)
+            {
+                acc += values;
+                return;
+            }
+
+            const TMask take = (Op == simd_op::min) ? (TMask)(values < acc) : (TMask)(acc < values);
+            acc = (TVector)(((TMask)values & take) | ((TMask)acc & ~take));
+        }
+
+        // Reduces count > 0 values with four vector accumulators, and the remainder one by one.
+        template<simd_op Op, typename T>
+        __attribute__((always_inline)) inline T simd_reduce_lanes(const T* values, size_t count)
+        {
+            using vector_t = typename simd_vector<T>::type;
+            using mask_t = typename simd_vector<T>::mask_t;
+
+            const size_t lanes = sizeof(vector_t) / sizeof(T);
+
+            // Min and max start with the first value, so NaN values behave like in the scalar loops.
+            const T initial = (Op == simd_op::sum) ? T() : values[0];
+            vector_t acc[4];
+
+            for (size_t a = 0; a < 4; ++a)
+                for (size_t l = 0; l < lanes; ++l)
+                    acc[a][l] = initial;
+
+            size_t i = 0;
+
+            for (; i + 4 * lanes <= count; i += 4 * lanes)
+            {
+                for (size_t a = 0; a < 4; ++a)
+                {
+                    vector_t v;
+                    std::memcpy(&v, values + i + a * lanes, sizeof(v));
+                    simd_combine_vector<Op, vector_t, mask_t>(v, acc[a]);
+                }
+            }
+
+            T result = initial;
+
+            for (size_t a = 0; a < 4; ++a)
+                for (size_t l = 0; l < lanes; ++l)
+                    result = simd_combine<Op>(static_cast<T>(acc[a][l]), result);
+
+            for (; i < count; ++i)
+                result = simd_combine<Op>(values[i], result);
+
+            return result;
+        }
+
+        template<simd_op Op, typename T>
+        T simd_reduce_default(const T* values, size_t count)
+        {
+            return simd_reduce_lanes<Op>(values, count);
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        template<simd_op Op, typename T>
+        __attribute__((target("avx2"))) T simd_reduce_avx2(const T* values, size_t count)
+        {
+            return simd_reduce_lanes<Op>(values, count);
+        }
+
+        inline bool cpu_supports_avx2()
+        {
+            static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+            return supported;
+        }
+#endif
+
+        // Reduces count > 0 values with the widest instructions the CPU supports.
+        template<simd_op Op, typename T>
+        inline T simd_reduce(const T* values, size_t count)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            if (cpu_supports_avx2())
+                return simd_reduce_avx2<Op>(values, count);
+#endif
+            return simd_reduce_default<Op>(values, count);
+        }
+
+#else
+
+        template<typename T>
+        struct is_simd_element : public std::false_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<simd_op Op, typename T>
+        inline T simd_reduce(const T* values, size_t count)
+        {
+            T result = (Op == simd_op::sum) ? T() : values[0];
+
+            for (size_t i = 0; i < count; ++i)
+                result = simd_combine<Op>(values[i], result);
+
+            return result;
+        }
+
+#endif
+
+        // Random access ranges of int, float and double are reduced with the SIMD kernels.
+        template<typename TRange>
+        struct is_simd_reducible : public std::integral_constant<bool,
+            is_simd_element<typename std::decay<typename TRange::iterator::output_t>::type>::value &&
+            is_random_access_iterator<typename TRange::iterator>::value
+        >
+        {
+            /* Nothing to define here. */
+        };
+
+        // Ranges whose elements are contiguous in memory, so they can be reduced in place.
+        template<typename TRange>
+        struct is_contiguous_range : public std::false_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename T, typename TAllocator>
+        struct is_contiguous_range<from_container_range<std::vector<T, TAllocator>>> : public std::true_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<simd_op Op, typename TIter>
+        inline typename std::decay<typename TIter::output_t>::type
+            simd_reduce_range(const TIter& begin, size_t count, std::true_type)
+        {
+            return simd_reduce<Op>(&*begin.Pos, count);
+        }
+
+        // Copies the elements block by block, and reduces every block.
+        template<simd_op Op, typename TIter>
+        typename std::decay<typename TIter::output_t>::type
+            simd_reduce_range(TIter begin, size_t count, std::false_type)
+        {
+            using value_t = typename std::decay<typename TIter::output_t>::type;
+
+            const size_t block_size = 256;
+            value_t block[block_size];
+            value_t result = value_t();
+
+            for (size_t done = 0; done < count; )
+            {
+                const size_t n = (std::min)(block_size, count - done);
+
+                for (size_t i = 0; i < n; ++i)
+                    block[i] = begin[i];
+
+                begin += static_cast<std::ptrdiff_t>(n);
+
+                const value_t blockResult = simd_reduce<Op>(block, n);
+                result = (done == 0) ? blockResult : simd_combine<Op>(blockResult, result);
+                done += n;
+            }
+
+            return result;
+        }
+
+        // Reduces a range for which is_simd_reducible holds. Empty ranges yield a default value.
+        template<simd_op Op, typename TRange>
+        inline typename std::decay<typename TRange::iterator::output_t>::type
+            simd_reduce_range(const TRange& range)
+        {
+            auto begin = range.begin();
+            const size_t count = static_cast<size_t>(range.end() - begin);
+
+            if (count == 0)
+                return typename std::decay<typename TRange::iterator::output_t>::type();
+
+            return simd_reduce_range<Op>(begin, count, is_contiguous_range<TRange>());
+        }
+
+        // ----------------------------------
+        // base_range
+        // ----------------------------------
+
+        // Base class to identify ALL range types (for compile-time type checking).
+        class base_range_ident
+        {
+            /* Nothing to define here. */
+        };
+
+        // Base class for sorting ranges (for compile-time type checking).
+        // Sorting ranges fill their buffer in begin(), which is why ranges
+        // always call begin() on their previous range before end().
+        class sorting_range
+        {
+            /* Nothing to define here. */
+        };
+
+        // Determines whether begin() of a range fills a buffer (directly or through a previous
+        // range), which invalidates the iterators of an earlier call. Ranges that need the front
+        // of such a range in end() can't simply call its begin() again, and call filled_begin()
+        // instead, which returns the front of the last filled buffer. Like end(), it is only
+        // valid after begin().
+        template<typename TRange>
+        struct fills_in_begin : public std::is_base_of<sorting_range, TRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TKeySelector>
+        struct fills_in_begin<group_by_range<TPrevRange, TKeySelector>> : public std::true_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TKeySelector, typename TAccumulate, typename TAccumFunc, bool HasSeed>
+        struct fills_in_begin<group_aggregate_range<TPrevRange, TKeySelector, TAccumulate, TAccumFunc, HasSeed>>
+            : public std::true_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TTransform>
+        struct fills_in_begin<select_range<TPrevRange, TTransform>> : public fills_in_begin<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange>
+        struct fills_in_begin<reverse_range<TPrevRange>> : public fills_in_begin<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange>
+        struct fills_in_begin<take_range<TPrevRange>> : public fills_in_begin<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange>
+        struct fills_in_begin<skip_range<TPrevRange>> : public fills_in_begin<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        /**
+        * Base class of all LINQ ranges.
+        */
+        template<
+            typename TMy,       // The fully qualified type of this range.
+            typename TOutput    // The full, unmodified type that is returned by this range.
+        >
+        class base_range : public base_range_ident
+        {
+        private:
+            // Return non-const, non-volatile, non-reference types from methods such as sum, min and max.
+            using output_t = typename std::decay<TOutput>::type;
+
+        public:
+            template<typename TPredicate>
+            where_range<TMy, TPredicate> where(const TPredicate& predicate) const;
+
+            distinct_range<TMy> distinct() const;
+
+            template<typename TKeySelector>
+            distinct_by_range<TMy, TKeySelector> distinct_by(const TKeySelector& keySelector) const;
+
+            template<typename TOtherRange>
+            union_range<TMy, TOtherRange> union_with(const TOtherRange& otherRange) const;
+
+            template<typename TOtherRange>
+            intersect_range<TMy, TOtherRange> intersect(const TOtherRange& otherRange) const;
+
+            template<typename TOtherRange>
+            except_range<TMy, TOtherRange> except(const TOtherRange& otherRange) const;
+
+            template<typename TTransform>
+            select_range<TMy, TTransform> select(const TTransform& transform) const;
+
+            template<typename TTransform>
+            select_many_range<TMy, TTransform> select_many(const TTransform& transform) const;
+
+            reverse_range<TMy> reverse() const;
+
+            take_range<TMy> take(size_t count) const;
+
+            template<typename TPredicate>
+            take_while_range<TMy, TPredicate> take_while(const TPredicate& predicate) const;
+
+            skip_range<TMy> skip(size_t count) const;
+
+            template<typename TPredicate>
+            skip_while_range<TMy, TPredicate> skip_while(const TPredicate& predicate) const;
+
+            // Yields the elements in spans of chunkSize elements (the last one may be shorter).
+            // Spans over std::vector point into the vector, others into a buffer that is reused
+            // for every chunk.
+            chunk_range<TMy> chunk(size_t chunkSize) const;
+
+            // Enumerates this range on a separate producer thread, which runs ahead of the
+            // consumer by at most capacity elements. When the enumeration stops early, the
+            // producer is cancelled once the range is destroyed or enumerated again.
+            buffered_range<TMy> buffered(size_t capacity) const;
+
+            template<typename TOtherRange>
+            append_range<TMy, TOtherRange> append(const TOtherRange& otherRange) const;
+
+            repeat_range<TMy> repeat(size_t count) const;
+
+            template<typename TOtherRange, typename TKeySelectorA, typename TKeySelectorB, typename TTransform>
+            join_range<TMy, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform> join(
+                const TOtherRange& otherRange,
+                const TKeySelectorA& keySelectorA,
+                const TKeySelectorB& keySelectorB,
+                const TTransform& transform
+                ) const;
+
+            template<typename TOtherRange, typename TKeySelectorA, typename TKeySelectorB, typename TTransform>
+            merge_join_range<TMy, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform> merge_join(
+                const TOtherRange& otherRange,
+                const TKeySelectorA& keySelectorA,
+                const TKeySelectorB& keySelectorB,
+                const TTransform& transform
+                ) const;
+
+            template<typename TKeySelector>
+            order_by_range<TMy, TKeySelector> order_by(const TKeySelector& keySelector, sort_direction sortDir) const;
+
+            template<typename TKeySelector>
+            order_by_range<TMy, TKeySelector> order_by(
+                const TKeySelector& keySelector,
+                sort_direction sortDir,
+                parallel_policy
+                ) const;
+
+            template<typename TKeySelector>
+            inline order_by_range<TMy, TKeySelector> order_by_ascending(const TKeySelector& keySelector) const
+            {
+                return order_by<TKeySelector>(keySelector, linq::sort_direction::ascending);
+            }
+
+            template<typename TKeySelector>
+            inline order_by_range<TMy, TKeySelector> order_by_descending(const TKeySelector& keySelector) const
+            {
+                return order_by<TKeySelector>(keySelector, linq::sort_direction::descending);
+            }
+
+            template<typename TKeySelector>
+            order_by_external_range<TMy, TKeySelector> order_by_external(
+                const TKeySelector& keySelector,
+                sort_direction sortDir,
+                size_t memoryBudget,
+                const std::string& tempDirectory = std::string()
+                ) const;
+
+            template<typename TKeySelector>
+            take_range<order_by_range<TMy, TKeySelector>> top_k(
+                size_t count,
+                const TKeySelector& keySelector,
+                sort_direction sortDir
+                ) const;
+
+            template<typename TKeySelector>
+            then_by_range<TMy, TKeySelector> then_by(const TKeySelector& keySelector, sort_direction sortDir) const;
+
+            template<typename TKeySelector>
+            group_by_range<TMy, TKeySelector> group_by(const TKeySelector& keySelector) const;
+
+            // Yields a std::pair of every key and the aggregate of its elements, which starts
+            // with the first element of the key and continues with aggregator(aggregate, element).
+            template<typename TKeySelector, typename TAccumFunc>
+            group_aggregate_range<TMy, TKeySelector, output_t, TAccumFunc, false> group_by(
+                const TKeySelector& keySelector,
+                const TAccumFunc& aggregator
+                ) const;
+
+            // Like above, but the aggregate of every key starts with aggregator(seed, element).
+            template<typename TKeySelector, typename TAccumulate, typename TAccumFunc>
+            group_aggregate_range<TMy, TKeySelector, TAccumulate, TAccumFunc, true> group_by(
+                const TKeySelector& keySelector,
+                const TAccumulate& seed,
+                const TAccumFunc& aggregator
+                ) const;
+
+            // Returns the results of group_by(keySelector, aggregator) as a vector. Sliceable ranges
+            // (see aggregate_parallel()) are aggregated on multiple threads, which also merge the
+            // aggregates of different slices with aggregator. The order of the results is unspecified.
+            template<typename TKeySelector, typename TAccumFunc>
+            std::vector<std::pair<typename group_by_traits<TMy, TKeySelector>::key_t, output_t>> aggregate_by(
+                const TKeySelector& keySelector,
+                const TAccumFunc& aggregator,
+                parallel_policy
+                ) const;
+
+            template<typename TKeySelector>
+            inline then_by_range<TMy, TKeySelector> then_by_ascending(const TKeySelector& keySelector) const
+            {
+                return then_by<TKeySelector>(keySelector, linq::sort_direction::ascending);
+            }
+
+            template<typename TKeySelector>
+            inline then_by_range<TMy, TKeySelector> then_by_descending(const TKeySelector& keySelector) const
+            {
+                return then_by<TKeySelector>(keySelector, linq::sort_direction::descending);
+            }
+
+            output_t sum() const;
+            output_t min() const;
+            output_t max() const;
+
+            typename avg_calculator<TMy, output_t>::output_t average() const;
+
+            range_stats<output_t, typename avg_calculator<TMy, output_t>::output_t> stats() const;
+
+            template<typename TAccumFunc>
+            output_t aggregate(const TAccumFunc& func) const;
+
+            // Splits ranges over random access containers (optionally followed by where and select)
+            // into chunks that are reduced on multiple threads. Every chunk starts with identity,
+            // and combine merges the results of two chunks. Other ranges are reduced sequentially.
+            template<typename TResult, typename TAccumFunc, typename TCombineFunc>
+            TResult aggregate_parallel(
+                const TResult& identity,
+                const TAccumFunc& func,
+                const TCombineFunc& combine
+                ) const;
+
+            // Parallel versions of sum, min, max and count, see aggregate_parallel().
+            output_t sum(parallel_policy) const;
+            output_t min(parallel_policy) const;
+            output_t max(parallel_policy) const;
+
+            template<typename TPredicate>
+            size_t count(const TPredicate& predicate, parallel_policy) const;
+
+            output_t first(const output_t& defaultValue = output_t()) const;
+
+            template<typename TPredicate>
+            output_t first(const TPredicate& predicate, const output_t& defaultValue = output_t()) const;
+
+            output_t last(const output_t& defaultValue = output_t()) const;
+
+            template<typename TPredicate>
+            output_t last(const TPredicate& predicate, const output_t& defaultValue = output_t()) const;
+
+            template<typename TPredicate>
+            bool any(const TPredicate& predicate) const;
+
+            template<typename TPredicate>
+            bool all(const TPredicate& predicate) const;
+
+            size_t count() const;
+
+            template<typename TPredicate>
+            size_t count(const TPredicate& predicate) const;
+
+            output_t element_at(size_t index, const output_t& defaultValue = output_t()) const;
+
+            std::vector<output_t> to_vector() const;
+
+            // Parallel version of to_vector() that keeps the order of the range.
+            std::vector<output_t> to_vector(parallel_policy) const;
+
+            // Runs the terminals of the query on multiple threads, see parallel_range.
+            parallel_range<TMy> parallel() const;
+
+            // Ranges that know more about their size hide this.
+            inline range_size size_hint() const
+            {
+                return range_size::unknown();
+            }
+
+        private:
+            output_t sum(std::true_type) const;
+            output_t sum(std::false_type) const;
+            output_t min(std::true_type) const;
+            output_t min(std::false_type) const;
+            output_t max(std::true_type) const;
+            output_t max(std::false_type) const;
+
+            template<simd_op Op>
+            output_t reduce_parallel() const;
+
+            template<typename TIter>
+            static output_t last_of(TIter begin, const TIter& end, std::false_type);
+
+            template<typename TIter>
+            static output_t last_of(const TIter& begin, TIter end, std::true_type);
+        };
+
+        // ----------------------------------
+        // where
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TPredicate>
+        class where_range : public base_range<
+            where_range<TPrevRange, TPredicate>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = typename prev_iter_t::output_t;
+
+                iterator() = default;
+
+                iterator(const where_range* parent, prev_iter_t begin, prev_iter_t end)
+                    : Parent(parent)
+                    , Begin(begin)
+                    , End(end)
+                {
+                    const auto& pred = *Parent->Predicate;
+
+                    // Seek the first match.
+                    while (Begin != End && !pred(*Begin))
+                        ++Begin;
+                }
+
+                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
+                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+
+                inline iterator& operator++()
+                {
+                    const auto& pred = *Parent->Predicate;
+
+                    do
+                    {
+                        ++Begin;
+                    } while (Begin != End && !pred(*Begin));
+
+                    return *this;
+                }
+
+                inline output_t operator*() const { return *Begin; }
+
+                const where_range* Parent;
+                prev_iter_t Begin;
+                prev_iter_t End;
+            };
+
+        public:
+            where_range() = default;
+
+            where_range(const TPrevRange& prev, const TPredicate& predicate)
+                : Prev(prev)
+                , Predicate(&predicate)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                return iterator(this, begin, Prev.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Prev.end(), Prev.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+            // Restricts the range to the elements that stem from [first, last) of its source
+            // (only available if is_sliceable holds).
+            inline where_range slice(size_t first, size_t last) const
+            {
+                return where_range(Prev.slice(first, last), *Predicate);
+            }
+
+            inline size_t slice_size() const
+            {
+                return Prev.slice_size();
+            }
+
+        private:
+            TPrevRange Prev;
+            const TPredicate* Predicate;
+        };
+
+        // ----------------------------------
+        // distinct
+        // ----------------------------------
+
+        // Yields every element only once. Elements whose type has a std::hash are
+        // remembered in a hash_set. All others are found by a linear search
+        // through the iterators of the elements that were encountered so far.
+        template<typename TPrevRange>
+        class distinct_range : public base_range<
+            distinct_range<TPrevRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        private:
+            using prev_iter_t = typename TPrevRange::iterator;
+            using value_t = typename std::decay<typename prev_iter_t::output_t>::type;
+
+            using object_container = typename std::conditional<
+                is_hashable<value_t>::value,
+                hash_set<value_t>,
+                std::vector<prev_iter_t>
+            >::type;
+
+        public:
+            struct iterator
+            {
+                using output_t = typename prev_iter_t::output_t;
+
+                iterator() = default;
 
                 iterator(prev_iter_t begin, prev_iter_t end, object_container* encounteredObjects)
                     : Begin(begin)
                     , End(end)
-                    , EncounteredObjects(encounteredObjects)
+                    , EncounteredObjects(encounteredObjects)
+                {
+                    if (Begin != End)
+                    {
+                        encounteredObjects->clear();
+                        AddObject(*encounteredObjects, Begin);
+                    }
+                }
+
+                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
+                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+
+                iterator& operator++()
+                {
+                    do
+                    {
+                        ++Begin;
+                    } while (Begin != End && !AddObject(*EncounteredObjects, Begin));
+
+                    return *this;
+                }
+
+                inline output_t operator*() const { return *Begin; }
+
+                prev_iter_t Begin;
+                prev_iter_t End;
+                object_container* EncounteredObjects;
+
+            private:
+                // Adds an object unless it was encountered before. Returns whether it was added.
+                static inline bool AddObject(hash_set<value_t>& objects, const prev_iter_t& it)
+                {
+                    return objects.insert(*it);
+                }
+
+                static bool AddObject(std::vector<prev_iter_t>& objects, const prev_iter_t& it)
+                {
+                    const auto& itVal = *it;
+
+                    for (size_t i = 0; i < objects.size(); ++i)
+                        if (*objects[i] == itVal)
+                            return false;
+
+                    objects.push_back(it);
+                    return true;
+                }
+            };
+
+        public:
+            distinct_range() = default;
+
+            explicit distinct_range(const TPrevRange& prev)
+                : Prev(prev)
+            {}
+
+            iterator begin() const
+            {
+                auto begin = Prev.begin();
+                const range_size size = Prev.size_hint();
+
+                // Every element is inserted at most once, so the exact size is an upper bound.
+                if (size.IsExact)
+                    EncounteredObjects.reserve(size.Size);
+
+                return iterator(begin, Prev.end(), &EncounteredObjects);
+            }
+
+            iterator end() const
+            {
+                return iterator(Prev.end(), Prev.end(), &EncounteredObjects);
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+        private:
+            TPrevRange Prev;
+            mutable object_container EncounteredObjects;
+        };
+
+        // ----------------------------------
+        // select
+        // ----------------------------------
+
+        // Resolves the arguments that are passed to a select functor.
+        template<typename TPrevRange>
+        using select_transform_arg_t = typename std::add_const<
+            typename std::add_lvalue_reference<typename TPrevRange::iterator::output_t>::type
+        >::type;
+
+        // Resolves the return type of a select functor.
+        template<typename TPrevRange, typename TTransform>
+        using select_output_t = typename std::result_of<
+            TTransform(select_transform_arg_t<TPrevRange>)
+        >::type;
+
+        template<typename TPrevRange, typename TTransform>
+        class select_range : public base_range<
+            select_range<TPrevRange, TTransform>,
+            select_output_t<TPrevRange, TTransform>
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = select_output_t<TPrevRange, TTransform>;
+                using category = inherited_category_t<prev_iter_t>;
+
+                iterator() = default;
+
+                iterator(const select_range* parent, prev_iter_t begin, prev_iter_t end)
+                    : Parent(parent)
+                    , Begin(begin)
+                    , End(end)
+                {}
+
+                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
+                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+
+                inline iterator& operator++()
+                {
+                    ++Begin;
+                    return *this;
+                }
+
+                inline iterator& operator--()
+                {
+                    --Begin;
+                    return *this;
+                }
+
+                inline iterator& operator+=(std::ptrdiff_t n)
+                {
+                    Begin += n;
+                    return *this;
+                }
+
+                inline std::ptrdiff_t operator-(const iterator& o) const { return Begin - o.Begin; }
+
+                inline output_t operator*() const
+                {
+                    const auto& transform = *Parent->Transform;
+                    return transform(*Begin);
+                }
+
+                inline output_t operator[](std::ptrdiff_t n) const
+                {
+                    const auto& transform = *Parent->Transform;
+                    return transform(Begin[n]);
+                }
+
+                const select_range* Parent;
+                prev_iter_t Begin;
+                prev_iter_t End;
+            };
+
+        public:
+            select_range() = default;
+
+            select_range(const TPrevRange& prev, const TTransform& transform)
+                : Prev(prev)
+                , Transform(&transform)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                return iterator(this, begin, Prev.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Prev.end(), Prev.end());
+            }
+
+            // See fills_in_begin.
+            inline iterator filled_begin() const
+            {
+                return iterator(this, Prev.filled_begin(), Prev.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return Prev.size_hint();
+            }
+
+            // See where_range::slice().
+            inline select_range slice(size_t first, size_t last) const
+            {
+                return select_range(Prev.slice(first, last), *Transform);
+            }
+
+            inline size_t slice_size() const
+            {
+                return Prev.slice_size();
+            }
+
+        private:
+            TPrevRange Prev;
+            const TTransform* Transform;
+        };
+
+        // ----------------------------------
+        // select_many
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TTransform>
+        struct select_many_traits
+        {
+            using returned_range_t = typename std::result_of<
+                TTransform(typename TPrevRange::iterator::output_t)
+            >::type;
+
+            // See if the returned type is really a range.
+            static_assert(
+                std::is_base_of<base_range_ident, returned_range_t>::value,
+                "The transform function of select_many is expected to return a LINQ range."
+                );
+
+            using output_t = typename returned_range_t::iterator::output_t;
+        };
+
+        template<typename TPrevRange, typename TTransform>
+        class select_many_range : public base_range<
+            select_many_range<TPrevRange, TTransform>,
+            typename select_many_traits<TPrevRange, TTransform>::output_t
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+
+                using returned_range_t = typename select_many_traits<TPrevRange, TTransform>::returned_range_t;
+                using returned_range_iter_t = typename returned_range_t::iterator;
+                using output_t = typename returned_range_iter_t::output_t;
+
+                iterator() = default;
+
+                iterator(const select_many_range* parent, prev_iter_t pos, prev_iter_t end)
+                    : Parent(parent)
+                    , Pos(pos)
+                    , End(end)
+                {
+                    if (Pos != End)
+                    {
+                        const auto& transform = *Parent->Transform;
+                        bool first = true;
+
+                        do
+                        {
+                            if (!first)
+                                ++Pos;
+
+                            if (Pos == End)
+                                break;
+
+                            RetRange = transform(*Pos);
+                            RetBegin = RetRange.begin();
+                            RetEnd = RetRange.end();
+
+                            first = false;
+                        }
+                        while (RetBegin == RetEnd);
+                    }
+                }
+
+                inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const iterator& o) const { return Pos != o.Pos; }
+
+                inline iterator& operator++()
+                {
+                    if (RetBegin != RetEnd)
+                    {
+                        // There are values left to be obtained from the returned range.
+                        ++RetBegin;
+                    }
+
+                    if (RetBegin == RetEnd)
+                    {
+                        // Move our parent iterator forward to get the next container.
+                        ++Pos;
+                        if (Pos != End)
+                        {
+                            const auto& transform = *Parent->Transform;
+                            RetRange = transform(*Pos);
+                            RetBegin = RetRange.begin();
+                            RetEnd = RetRange.end();
+                        }
+                    }
+
+                    return *this;
+                }
+
+                inline output_t operator*() const { return *RetBegin; }
+
+                const select_many_range* Parent;
+                prev_iter_t Pos;
+                prev_iter_t End;
+
+                returned_range_t RetRange;
+                returned_range_iter_t RetBegin;
+                returned_range_iter_t RetEnd;
+            };
+
+        public:
+            select_many_range() = default;
+
+            select_many_range(const TPrevRange& prev, const TTransform& transform)
+                : Prev(prev)
+                , Transform(&transform)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                return iterator(this, begin, Prev.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Prev.end(), Prev.end());
+            }
+
+        private:
+            TPrevRange Prev;
+            const TTransform* Transform;
+        };
+
+        // ----------------------------------
+        // reverse
+        // ----------------------------------
+
+        template<typename TPrevRange>
+        class reverse_range : public base_range<
+            reverse_range<TPrevRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        private:
+            using prev_iter_t = typename TPrevRange::iterator;
+            using object_container = std::vector<prev_iter_t>;
+            using is_bidirectional = is_bidirectional_iterator<prev_iter_t>;
+
+        public:
+            // Iterates through the stored iterators of a forward-only range.
+            struct buffered_iterator
+            {
+                using output_t = typename prev_iter_t::output_t;
+
+                buffered_iterator() = default;
+
+                buffered_iterator(const object_container* prevIterators, size_t index)
+                    : PrevIterators(prevIterators)
+                    , Index(index)
+                {}
+
+                inline bool operator==(const buffered_iterator& o) const { return Index == o.Index; }
+                inline bool operator!=(const buffered_iterator& o) const { return Index != o.Index; }
+
+                inline buffered_iterator& operator++()
+                {
+                    --Index;
+                    return *this;
+                }
+
+                inline output_t operator*() const { return *PrevIterators->at(Index); }
+
+                const object_container* PrevIterators;
+                size_t Index;
+            };
+
+            // Walks a bidirectional range backwards, pointing one past the current element.
+            struct bidirectional_iterator
+            {
+                using output_t = typename prev_iter_t::output_t;
+                using category = inherited_category_t<prev_iter_t>;
+
+                bidirectional_iterator() = default;
+
+                explicit bidirectional_iterator(prev_iter_t pos)
+                    : Pos(pos)
+                {}
+
+                inline bool operator==(const bidirectional_iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const bidirectional_iterator& o) const { return Pos != o.Pos; }
+
+                inline bidirectional_iterator& operator++()
+                {
+                    --Pos;
+                    return *this;
+                }
+
+                inline bidirectional_iterator& operator--()
+                {
+                    ++Pos;
+                    return *this;
+                }
+
+                inline bidirectional_iterator& operator+=(std::ptrdiff_t n)
+                {
+                    Pos += -n;
+                    return *this;
+                }
+
+                inline std::ptrdiff_t operator-(const bidirectional_iterator& o) const { return o.Pos - Pos; }
+
+                inline output_t operator*() const
+                {
+                    auto current = Pos;
+                    return *--current;
+                }
+
+                inline output_t operator[](std::ptrdiff_t n) const { return Pos[-n - 1]; }
+
+                prev_iter_t Pos;
+            };
+
+            using iterator = typename std::conditional<
+                is_bidirectional::value,
+                bidirectional_iterator,
+                buffered_iterator
+            >::type;
+
+        public:
+            reverse_range() = default;
+
+            explicit reverse_range(const TPrevRange& prev)
+                : Prev(prev)
+            {}
+
+            inline iterator begin() const
+            {
+                return begin(is_bidirectional());
+            }
+
+            inline iterator end() const
+            {
+                return end(is_bidirectional());
+            }
+
+            // See fills_in_begin.
+            inline iterator filled_begin() const
+            {
+                return filled_begin(is_bidirectional());
+            }
+
+            inline range_size size_hint() const
+            {
+                return Prev.size_hint();
+            }
+
+        private:
+            inline bidirectional_iterator begin(std::true_type) const
+            {
+                // Sorting ranges fill their buffer in begin(), which has to come before end().
+                Prev.begin();
+                return bidirectional_iterator(Prev.end());
+            }
+
+            // The end is the front of the previous range (see fills_in_begin).
+            inline bidirectional_iterator end(std::true_type) const
+            {
+                return bidirectional_iterator(front(fills_in_begin<TPrevRange>()));
+            }
+
+            inline prev_iter_t front(std::true_type) const
+            {
+                return Prev.filled_begin();
+            }
+
+            inline prev_iter_t front(std::false_type) const
+            {
+                return Prev.begin();
+            }
+
+            inline buffered_iterator begin(std::false_type) const
+            {
+                PrevIterators.clear();
+
+                const range_size size = Prev.size_hint();
+
+                if (size.IsExact)
+                    PrevIterators.reserve(size.Size);
+
+                for (auto beg = Prev.begin(), end = Prev.end(); beg != end; ++beg)
+                    PrevIterators.push_back(beg);
+
+                return buffered_iterator(&PrevIterators, PrevIterators.size() - 1);
+            }
+
+            inline buffered_iterator end(std::false_type) const
+            {
+                return buffered_iterator(nullptr, -1);
+            }
+
+            inline bidirectional_iterator filled_begin(std::true_type) const
+            {
+                return bidirectional_iterator(Prev.end());
+            }
+
+            inline buffered_iterator filled_begin(std::false_type) const
+            {
+                return buffered_iterator(&PrevIterators, PrevIterators.size() - 1);
+            }
+
+            TPrevRange Prev;
+            mutable object_container PrevIterators;
+        };
+
+        // ----------------------------------
+        // take
+        // ----------------------------------
+
+        template<typename TPrevRange>
+        class take_range : public base_range<
+            take_range<TPrevRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = typename prev_iter_t::output_t;
+
+                // The end of a forward range is only found by counting, so going
+                // backwards requires random access to the previous range.
+                using category = typename std::conditional<
+                    is_random_access_iterator<prev_iter_t>::value,
+                    std::random_access_iterator_tag,
+                    std::forward_iterator_tag
+                >::type;
+
+                iterator() = default;
+
+                iterator(prev_iter_t begin, size_t count)
+                    : Begin(begin)
+                    , Count(count)
+                {}
+
+                inline bool operator==(const iterator& o) const { return Count == o.Count || Begin == o.Begin; }
+                inline bool operator!=(const iterator& o) const { return Count != o.Count && Begin != o.Begin; }
+
+                inline iterator& operator++()
+                {
+                    ++Begin;
+                    --Count;
+                    return *this;
+                }
+
+                inline iterator& operator--()
+                {
+                    --Begin;
+                    ++Count;
+                    return *this;
+                }
+
+                inline iterator& operator+=(std::ptrdiff_t n)
+                {
+                    Begin += n;
+                    Count -= n;
+                    return *this;
+                }
+
+                inline std::ptrdiff_t operator-(const iterator& o) const
+                {
+                    return (std::min)(
+                        static_cast<std::ptrdiff_t>(o.Count - Count),
+                        Begin - o.Begin);
+                }
+
+                inline output_t operator*() const { return *Begin; }
+                inline output_t operator[](std::ptrdiff_t n) const { return Begin[n]; }
+
+                prev_iter_t Begin;
+                size_t Count;
+            };
+
+        public:
+            take_range() = default;
+
+            take_range(const TPrevRange& prev, size_t count)
+                : Prev(prev)
+                , Count(count)
+            {}
+
+            inline iterator begin() const
+            {
+                return iterator(begin_prev(std::is_base_of<sorting_range, TPrevRange>()), Count);
+            }
+
+            inline iterator end() const
+            {
+                return end(is_random_access_iterator<typename iterator::prev_iter_t>());
+            }
+
+            // See fills_in_begin.
+            inline iterator filled_begin() const
+            {
+                return iterator(Prev.filled_begin(), Count);
+            }
+
+            inline range_size size_hint() const
+            {
+                const range_size prev = Prev.size_hint();
+                return range_size((std::min)(Count, prev.Size), prev.IsExact);
+            }
+
+        private:
+            // Points to the actual end, so the iterators can be used backwards.
+            inline iterator end(std::true_type) const
+            {
+                const auto front = front_prev(fills_in_begin<TPrevRange>());
+                const auto prevEnd = Prev.end();
+
+                iterator last(front, Count);
+                last += static_cast<std::ptrdiff_t>(
+                    (std::min)(Count, static_cast<size_t>(prevEnd - front)));
+                return last;
+            }
+
+            // Ranges that fill a buffer in begin() must not be filled again (see fills_in_begin).
+            inline typename iterator::prev_iter_t front_prev(std::true_type) const
+            {
+                return Prev.filled_begin();
+            }
+
+            inline typename iterator::prev_iter_t front_prev(std::false_type) const
+            {
+                return Prev.begin();
+            }
+
+            inline iterator end(std::false_type) const
+            {
+                return iterator(Prev.end(), 0);
+            }
+
+            // A sorting range only has to find its first Count elements.
+            inline typename iterator::prev_iter_t begin_prev(std::true_type) const
+            {
+                return Prev.begin_top(Count);
+            }
+
+            inline typename iterator::prev_iter_t begin_prev(std::false_type) const
+            {
+                return Prev.begin();
+            }
+
+            TPrevRange Prev;
+            size_t Count;
+        };
+
+        // ----------------------------------
+        // take_while
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TPredicate>
+        class take_while_range : public base_range<
+            take_while_range<TPrevRange, TPredicate>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = typename prev_iter_t::output_t;
+
+                iterator() = default;
+
+                iterator(const take_while_range* parent, prev_iter_t begin, prev_iter_t end)
+                    : Parent(parent)
+                    , Begin(begin)
+                    , End(end)
+                {
+                    const auto& pred = *Parent->Predicate;
+                    if (Begin != End && !pred(*Begin))
+                    {
+                        Begin = End;
+                    }
+                }
+
+                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
+                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+
+                inline iterator& operator++()
+                {
+                    ++Begin;
+
+                    const auto& pred = *Parent->Predicate;
+                    if (Begin != End && !pred(*Begin))
+                        Begin = End;
+
+                    return *this;
+                }
+
+                inline output_t operator*() const { return *Begin; }
+
+                const take_while_range* Parent;
+                prev_iter_t Begin;
+                prev_iter_t End;
+            };
+
+        public:
+            take_while_range() = default;
+
+            take_while_range(const TPrevRange& prev, const TPredicate& predicate)
+                : Prev(prev)
+                , Predicate(&predicate)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                return iterator(this, begin, Prev.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Prev.end(), Prev.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+        private:
+            TPrevRange Prev;
+            const TPredicate* Predicate;
+        };
+
+        // ----------------------------------
+        // skip
+        // ----------------------------------
+
+        template<typename TPrevRange>
+        class skip_range : public base_range<
+            skip_range<TPrevRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = typename prev_iter_t::output_t;
+                using category = inherited_category_t<prev_iter_t>;
+
+                iterator() = default;
+
+                iterator(prev_iter_t begin, prev_iter_t end, size_t count)
+                    : Begin(begin)
+                {
+                    iterator_advance(Begin, end, count);
+                }
+
+                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
+                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+
+                inline iterator& operator++()
+                {
+                    ++Begin;
+                    return *this;
+                }
+
+                inline iterator& operator--()
+                {
+                    --Begin;
+                    return *this;
+                }
+
+                inline iterator& operator+=(std::ptrdiff_t n)
+                {
+                    Begin += n;
+                    return *this;
+                }
+
+                inline std::ptrdiff_t operator-(const iterator& o) const { return Begin - o.Begin; }
+
+                inline output_t operator*() const { return *Begin; }
+                inline output_t operator[](std::ptrdiff_t n) const { return Begin[n]; }
+
+                prev_iter_t Begin;
+            };
+
+        public:
+            skip_range(const TPrevRange& prev, size_t count)
+                : Prev(prev)
+                , Count(count)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                return iterator(begin, Prev.end(), Count);
+            }
+
+            inline iterator end() const
+            {
+                return iterator(Prev.end(), Prev.end(), 0);
+            }
+
+            // See fills_in_begin.
+            inline iterator filled_begin() const
+            {
+                return iterator(Prev.filled_begin(), Prev.end(), Count);
+            }
+
+            inline range_size size_hint() const
+            {
+                const range_size prev = Prev.size_hint();
+                return range_size(prev.Size - (std::min)(Count, prev.Size), prev.IsExact);
+            }
+
+        private:
+            TPrevRange Prev;
+            size_t Count;
+        };
+
+        // ----------------------------------
+        // skip_while
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TPredicate>
+        class skip_while_range : public base_range<
+            skip_while_range<TPrevRange, TPredicate>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = typename prev_iter_t::output_t;
+
+                iterator() = default;
+
+                iterator(prev_iter_t begin, prev_iter_t end, const TPredicate& predicate)
+                    : Begin(begin)
+                {
+                    while (Begin != end && predicate(*Begin))
+                        ++Begin;
+                }
+
+                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
+                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+
+                inline iterator& operator++()
+                {
+                    ++Begin;
+                    return *this;
+                }
+
+                inline output_t operator*() const { return *Begin; }
+
+                prev_iter_t Begin;
+            };
+
+        public:
+            skip_while_range(const TPrevRange& prev, const TPredicate& predicate)
+                : Prev(prev)
+                , Predicate(&predicate)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                return iterator(begin, Prev.end(), *Predicate);
+            }
+
+            inline iterator end() const
+            {
+                return iterator(Prev.end(), Prev.end(), *Predicate);
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+        private:
+            TPrevRange Prev;
+            const TPredicate* Predicate;
+        };
+
+        // ----------------------------------
+        // chunk
+        // ----------------------------------
+
+        // A view of consecutive elements in memory, as yielded by chunk_range.
+        template<typename T>
+        class span
+        {
+        public:
+            using value_type = T;
+            using const_iterator = const T*;
+            using iterator = const T*;
+
+            span() = default;
+
+            span(const T* data, size_t size)
+                : Data(data)
+                , Size(size)
+            {}
+
+            inline const T* begin() const { return Data; }
+            inline const T* end() const { return Data + Size; }
+            inline const T* data() const { return Data; }
+            inline size_t size() const { return Size; }
+            inline bool empty() const { return Size == 0; }
+            inline const T& operator[](size_t index) const { return Data[index]; }
+
+        private:
+            const T* Data;
+            size_t Size;
+        };
+
+        template<typename TPrevRange>
+        class chunk_range : public base_range<
+            chunk_range<TPrevRange>,
+            span<typename std::decay<typename TPrevRange::iterator::output_t>::type>
+        >
+        {
+        private:
+            using prev_iter_t = typename TPrevRange::iterator;
+            using value_t = typename std::decay<typename prev_iter_t::output_t>::type;
+
+            // std::vector<bool> has no contiguous storage.
+            using is_contiguous = std::integral_constant<bool,
+                is_contiguous_range<TPrevRange>::value && !std::is_same<value_t, bool>::value>;
+
+            static_assert(!std::is_same<value_t, bool>::value || is_contiguous::value,
+                "chunk() can't buffer ranges of bool.");
+
+        public:
+            // Yields spans that point directly into the source container.
+            struct contiguous_iterator
+            {
+                using output_t = span<value_t>;
+
+                contiguous_iterator() = default;
+
+                contiguous_iterator(const value_t* pos, const value_t* end, size_t chunkSize)
+                    : Pos(pos)
+                    , End(end)
+                    , ChunkSize(chunkSize)
+                {}
+
+                inline bool operator==(const contiguous_iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const contiguous_iterator& o) const { return Pos != o.Pos; }
+
+                inline contiguous_iterator& operator++()
+                {
+                    Pos += current_size();
+                    return *this;
+                }
+
+                inline output_t operator*() const { return output_t(Pos, current_size()); }
+
+                inline size_t current_size() const
+                {
+                    return (std::min)(ChunkSize, static_cast<size_t>(End - Pos));
+                }
+
+                const value_t* Pos;
+                const value_t* End;
+                size_t ChunkSize;
+            };
+
+            // Copies every chunk into the buffer of the range, which is reused for the next one.
+            // A span is therefore only valid until the iterator is incremented.
+            struct buffered_iterator
+            {
+                using output_t = span<value_t>;
+
+                buffered_iterator() = default;
+
+                buffered_iterator(const chunk_range* parent, prev_iter_t pos, prev_iter_t end)
+                    : Parent(parent)
+                    , Pos(pos)
+                    , End(end)
+                    , Size(0)
+                {}
+
+                // Pos is the position after the current chunk, so the last chunk and end()
+                // only differ in their size.
+                inline bool operator==(const buffered_iterator& o) const { return Pos == o.Pos && Size == o.Size; }
+                inline bool operator!=(const buffered_iterator& o) const { return !(*this == o); }
+
+                inline buffered_iterator& operator++()
+                {
+                    auto& buffer = Parent->Buffer;
+                    buffer.clear();
+
+                    for (; Pos != End && buffer.size() < Parent->ChunkSize; ++Pos)
+                        buffer.push_back(*Pos);
+
+                    Size = buffer.size();
+                    return *this;
+                }
+
+                inline output_t operator*() const { return output_t(Parent->Buffer.data(), Size); }
+
+                const chunk_range* Parent;
+                prev_iter_t Pos;
+                prev_iter_t End;
+                size_t Size;
+            };
+
+            using iterator = typename std::conditional<
+                is_contiguous::value,
+                contiguous_iterator,
+                buffered_iterator
+            >::type;
+
+        public:
+            chunk_range() = default;
+
+            chunk_range(const TPrevRange& prev, size_t chunkSize)
+                : Prev(prev)
+                , ChunkSize((std::max)(chunkSize, size_t(1)))
+            {}
+
+            inline iterator begin() const
+            {
+                return begin(is_contiguous());
+            }
+
+            inline iterator end() const
+            {
+                return end(is_contiguous());
+            }
+
+            inline range_size size_hint() const
+            {
+                const range_size size = Prev.size_hint();
+                return range_size(size.Size / ChunkSize + (size.Size % ChunkSize != 0), size.IsExact);
+            }
+
+        private:
+            inline contiguous_iterator begin(std::true_type) const
+            {
+                auto begin = Prev.begin();
+                const size_t size = static_cast<size_t>(Prev.end() - begin);
+                const value_t* data = (size > 0) ? &*begin.Pos : nullptr;
+
+                // The end is kept, so end() doesn't have to call Prev.begin() again.
+                DataEnd = data + size;
+                return contiguous_iterator(data, DataEnd, ChunkSize);
+            }
+
+            inline contiguous_iterator end(std::true_type) const
+            {
+                return contiguous_iterator(DataEnd, DataEnd, ChunkSize);
+            }
+
+            inline buffered_iterator begin(std::false_type) const
+            {
+                // The buffer grows to the size of a chunk once, and keeps its capacity afterwards.
+                // It is only reserved up front if the size is known, since an upper bound (or an
+                // unknown size) could reserve far more than the range yields.
+                const range_size size = Prev.size_hint();
+
+                if (size.IsExact)
+                    Buffer.reserve((std::min)(ChunkSize, size.Size));
+
+                auto begin = Prev.begin();
+                return ++buffered_iterator(this, begin, Prev.end());
+            }
+
+            inline buffered_iterator end(std::false_type) const
+            {
+                auto end = Prev.end();
+                return buffered_iterator(this, end, end);
+            }
+
+            TPrevRange Prev;
+            size_t ChunkSize;
+            mutable const value_t* DataEnd;
+            mutable std::vector<value_t> Buffer;
+        };
+
+        // ----------------------------------
+        // buffered
+        // ----------------------------------
+
+        // A bounded queue for exactly one producer and one consumer thread. Head and Tail only
+        // grow, so Tail - Head is the number of stored elements. Each of them is written by one
+        // thread only, so elements are passed without locks. A thread that finds the queue full
+        // (which is the back-pressure on the producer) or empty yields for a few rounds, and
+        // then sleeps on a condition variable until the other thread makes progress. So a
+        // consumer that waits for a slow producer, or the other way around, doesn't burn a core.
+        template<typename T>
+        class spsc_queue
+        {
+        public:
+            explicit spsc_queue(size_t capacity)
+                : Capacity(capacity)
+                , Slots(new slot[capacity])
+                , Head(0)
+                , Tail(0)
+                , Done(false)
+                , Cancelled(false)
+                , Sleepers(0)
+            {}
+
+            ~spsc_queue()
+            {
+                for (size_t i = Head, end = Tail; i != end; ++i)
+                    at(i).~T();
+            }
+
+            spsc_queue(const spsc_queue&) = delete;
+            spsc_queue& operator=(const spsc_queue&) = delete;
+
+            // Producer: waits for a free slot. Returns false when the consumer cancelled.
+            template<typename TValue>
+            bool push(TValue&& value)
+            {
+                const size_t tail = Tail.load(std::memory_order_relaxed);
+
+                wait_until([&]()
+                {
+                    return tail - Head.load(std::memory_order_acquire) < Capacity || cancelled();
+                });
+
+                if (cancelled())
+                    return false;
+
+                new (&Slots[tail % Capacity]) T(std::forward<TValue>(value));
+                Tail.store(tail + 1);
+                wake();
+                return true;
+            }
+
+            // Producer: there are no more elements.
+            inline void finish()
+            {
+                Done.store(true);
+                wake();
+            }
+
+            // Consumer: waits for an element. Returns false when the producer has finished
+            // and all elements were consumed.
+            bool wait() const
+            {
+                const size_t head = Head.load(std::memory_order_relaxed);
+
+                wait_until([&]()
+                {
+                    return Tail.load(std::memory_order_acquire) != head || Done.load(std::memory_order_acquire);
+                });
+
+                return Tail.load(std::memory_order_acquire) != head;
+            }
+
+            // Consumer: the oldest element (only after wait() returned true).
+            inline const T& front() const { return at(Head.load(std::memory_order_relaxed)); }
+
+            // Consumer: removes the oldest element.
+            inline void pop()
+            {
+                const size_t head = Head.load(std::memory_order_relaxed);
+                at(head).~T();
+                Head.store(head + 1);
+                wake();
+            }
+
+            // Consumer: stops a producer that waits for a free slot.
+            inline void cancel()
+            {
+                Cancelled.store(true);
+                wake();
+            }
+
+            inline bool cancelled() const { return Cancelled.load(std::memory_order_relaxed); }
+
+        private:
+            using slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+            // The number of times a waiting thread yields before it goes to sleep.
+            static const size_t spin_count = 64;
+
+            inline T& at(size_t index) const { return *reinterpret_cast<T*>(&Slots[index % Capacity]); }
+
+            // Sleepers is incremented before the condition is checked under the lock, and wake()
+            // reads it after its (sequentially consistent) store. Either the sleeper sees the
+            // store, or wake() sees the sleeper and notifies it under the lock.
+            template<typename TReady>
+            void wait_until(const TReady& ready) const
+            {
+                for (size_t i = 0; i < spin_count; ++i)
+                {
+                    if (ready())
+                        return;
+
+                    std::this_thread::yield();
+                }
+
+                std::unique_lock<std::mutex> lock(Lock);
+                ++Sleepers;
+                Signal.wait(lock, ready);
+                --Sleepers;
+            }
+
+            inline void wake() const
+            {
+                if (Sleepers.load() != 0)
+                {
+                    std::lock_guard<std::mutex> lock(Lock);
+                    Signal.notify_all();
+                }
+            }
+
+            const size_t Capacity;
+            std::unique_ptr<slot[]> Slots;
+
+            // Kept apart, so that the two threads don't write to the same cache line
+            // (padded rather than aligned, since C++11 can't allocate over-aligned types).
+            std::atomic<size_t> Head;
+            char Padding[64];
+            std::atomic<size_t> Tail;
+            std::atomic<bool> Done;
+            std::atomic<bool> Cancelled;
+
+            mutable std::atomic<size_t> Sleepers;
+            mutable std::mutex Lock;
+            mutable std::condition_variable Signal;
+        };
+
+        // Enumerates the previous range on a producer thread and hands its elements to the
+        // consuming thread through an spsc_queue of at most Capacity elements.
+        template<typename TPrevRange>
+        class buffered_range : public base_range<
+            buffered_range<TPrevRange>,
+            typename std::decay<typename TPrevRange::iterator::output_t>::type
+        >
+        {
+        private:
+            using value_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
+
+            // The producer thread and its queue. Destroying it cancels and joins the producer.
+            class pipeline
+            {
+            public:
+                pipeline(const TPrevRange& prev, size_t capacity)
+                    : Prev(prev)
+                    , Queue(capacity)
+                    , Producer([this]() { produce(); })
+                {}
+
+                ~pipeline()
+                {
+                    Queue.cancel();
+                    Producer.join();
+                }
+
+                TPrevRange Prev;
+                spsc_queue<value_t> Queue;
+                std::thread Producer;
+
+            private:
+                void produce()
+                {
+                    for (auto beg = Prev.begin(), end = Prev.end(); beg != end && !Queue.cancelled(); ++beg)
+                        if (!Queue.push(*beg))
+                            break;
+
+                    Queue.finish();
+                }
+            };
+
+        public:
+            // A single pass iterator over the queue. end() is represented by a null pipeline.
+            struct iterator
+            {
+                using output_t = const value_t&;
+
+                iterator() = default;
+
+                explicit iterator(pipeline* p)
+                    : Pipeline((p != nullptr && p->Queue.wait()) ? p : nullptr)
+                {}
+
+                inline bool operator==(const iterator& o) const { return Pipeline == o.Pipeline; }
+                inline bool operator!=(const iterator& o) const { return Pipeline != o.Pipeline; }
+
+                inline iterator& operator++()
+                {
+                    Pipeline->Queue.pop();
+
+                    if (!Pipeline->Queue.wait())
+                        Pipeline = nullptr;
+
+                    return *this;
+                }
+
+                inline output_t operator*() const { return Pipeline->Queue.front(); }
+
+                pipeline* Pipeline;
+            };
+
+        public:
+            buffered_range() = default;
+
+            buffered_range(const TPrevRange& prev, size_t capacity)
+                : Prev(prev)
+                , Capacity((std::max)(capacity, size_t(1)))
+            {}
+
+            // Starts a new producer thread, after stopping the one of a previous enumeration.
+            inline iterator begin() const
+            {
+                Pipeline.reset();
+                Pipeline.reset(new pipeline(Prev, Capacity));
+                return iterator(Pipeline.get());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(nullptr);
+            }
+
+            inline range_size size_hint() const
+            {
+                return Prev.size_hint();
+            }
+
+        private:
+            TPrevRange Prev;
+            size_t Capacity;
+            mutable std::shared_ptr<pipeline> Pipeline;
+        };
+
+        // ----------------------------------
+        // append
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TOtherRange>
+        class append_range : public base_range<
+            append_range<TPrevRange, TOtherRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        private:
+            using other_range_iter_t = typename TOtherRange::iterator;
+
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = typename prev_iter_t::output_t;
+
+                iterator() = default;
+
+                iterator(prev_iter_t begin, prev_iter_t end, other_range_iter_t otherBegin, other_range_iter_t otherEnd)
+                    : MyBegin(begin)
+                    , MyEnd(end)
+                    , OtherBegin(otherBegin)
+                    , OtherEnd(otherEnd)
+                {}
+
+                inline bool operator==(const iterator& o) const { return OtherBegin == o.OtherBegin; }
+                inline bool operator!=(const iterator& o) const { return OtherBegin != o.OtherBegin; }
+
+                inline iterator& operator++()
+                {
+                    if (MyBegin != MyEnd)
+                        ++MyBegin;
+                    else
+                        ++OtherBegin;
+
+                    return *this;
+                }
+
+                inline output_t operator*() const
+                {
+                    return (MyBegin != MyEnd) ? *MyBegin : *OtherBegin;
+                }
+
+                prev_iter_t MyBegin;
+                prev_iter_t MyEnd;
+                other_range_iter_t OtherBegin;
+                other_range_iter_t OtherEnd;
+            };
+
+        public:
+            append_range(const TPrevRange& prev, const TOtherRange& otherRange)
+                : Prev(prev)
+                , OtherRange(otherRange)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                auto otherBegin = OtherRange.begin();
+                return iterator(begin, Prev.end(), otherBegin, OtherRange.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(Prev.end(), Prev.end(), OtherRange.end(), OtherRange.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return Prev.size_hint() + OtherRange.size_hint();
+            }
+
+        private:
+            TPrevRange Prev;
+            TOtherRange OtherRange;
+        };
+
+        // ----------------------------------
+        // set_filter_iterator
+        // ----------------------------------
+
+        // Iterator of the set operators. Skips all elements of the previous range
+        // that are rejected by the accept() method of the parent range, which
+        // checks and updates the parent's set.
+        template<typename TParent, typename TPrevIter>
+        struct set_filter_iterator
+        {
+            using output_t = typename TPrevIter::output_t;
+
+            set_filter_iterator() = default;
+
+            set_filter_iterator(const TParent* parent, TPrevIter begin, TPrevIter end)
+                : Parent(parent)
+                , Begin(begin)
+                , End(end)
+            {
+                while (Begin != End && !Parent->accept(Begin))
+                    ++Begin;
+            }
+
+            inline bool operator==(const set_filter_iterator& o) const { return Begin == o.Begin; }
+            inline bool operator!=(const set_filter_iterator& o) const { return Begin != o.Begin; }
+
+            inline set_filter_iterator& operator++()
+            {
+                do
+                {
+                    ++Begin;
+                } while (Begin != End && !Parent->accept(Begin));
+
+                return *this;
+            }
+
+            inline output_t operator*() const { return *Begin; }
+
+            const TParent* Parent;
+            TPrevIter Begin;
+            TPrevIter End;
+        };
+
+        // ----------------------------------
+        // distinct_by
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TKeySelector>
+        class distinct_by_range : public base_range<
+            distinct_by_range<TPrevRange, TKeySelector>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        private:
+            using prev_iter_t = typename TPrevRange::iterator;
+
+            using key_t = typename std::decay<
+                typename std::result_of<TKeySelector(typename prev_iter_t::output_t)>::type
+            >::type;
+
+            static_assert(is_hashable<key_t>::value,
+                "The key selector of distinct_by is expected to return a type that has a std::hash specialization."
+                );
+
+        public:
+            using iterator = set_filter_iterator<distinct_by_range, prev_iter_t>;
+
+            distinct_by_range(const TPrevRange& prev, const TKeySelector& keySelector)
+                : Prev(prev)
+                , KeySelector(&keySelector)
+            {}
+
+            inline iterator begin() const
+            {
+                Keys.clear();
+                auto begin = Prev.begin();
+                return iterator(this, begin, Prev.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Prev.end(), Prev.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+            // Accepts the first element of every key.
+            inline bool accept(const prev_iter_t& it) const
+            {
+                const auto& keySelector = *KeySelector;
+                return Keys.insert(keySelector(*it));
+            }
+
+        private:
+            TPrevRange Prev;
+            const TKeySelector* KeySelector;
+            mutable hash_set<key_t> Keys;
+        };
+
+        // ----------------------------------
+        // union_with
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TOtherRange>
+        class union_range : public base_range<
+            union_range<TPrevRange, TOtherRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        private:
+            using source_range_t = append_range<TPrevRange, TOtherRange>;
+            using source_iter_t = typename source_range_t::iterator;
+            using value_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
+
+            static_assert(is_hashable<value_t>::value,
+                "union_with can only be used with element types that have a std::hash specialization."
+                );
+
+        public:
+            using iterator = set_filter_iterator<union_range, source_iter_t>;
+
+            union_range(const TPrevRange& prev, const TOtherRange& otherRange)
+                : Source(prev, otherRange)
+            {}
+
+            inline iterator begin() const
+            {
+                Encountered.clear();
+                auto begin = Source.begin();
+                return iterator(this, begin, Source.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Source.end(), Source.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Source.size_hint().Size);
+            }
+
+            // Accepts every element of both ranges that was not encountered before.
+            inline bool accept(const source_iter_t& it) const
+            {
+                return Encountered.insert(*it);
+            }
+
+        private:
+            source_range_t Source;
+            mutable hash_set<value_t> Encountered;
+        };
+
+        // ----------------------------------
+        // intersect
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TOtherRange>
+        class intersect_range : public base_range<
+            intersect_range<TPrevRange, TOtherRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        private:
+            using prev_iter_t = typename TPrevRange::iterator;
+            using value_t = typename std::decay<typename prev_iter_t::output_t>::type;
+
+            static_assert(is_hashable<value_t>::value,
+                "intersect can only be used with element types that have a std::hash specialization."
+                );
+
+            // Maps every element of the other range to whether it was yielded already.
+            using table_t = hash_table<value_t, bool>;
+
+        public:
+            using iterator = set_filter_iterator<intersect_range, prev_iter_t>;
+
+            intersect_range(const TPrevRange& prev, const TOtherRange& otherRange)
+                : Prev(prev)
+                , OtherRange(otherRange)
+            {}
+
+            inline iterator begin() const
+            {
+                Table.clear();
+
+                for (const auto& val : OtherRange)
+                {
+                    const value_t& v = val;
+                    Table.insert(v, table_t::hash_of(v), false);
+                }
+
+                auto begin = Prev.begin();
+                return iterator(this, begin, Prev.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Prev.end(), Prev.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+            // Accepts every element that is in the other range, but only once.
+            inline bool accept(const prev_iter_t& it) const
+            {
+                const value_t& v = *it;
+                auto entry = Table.find(v, table_t::hash_of(v));
+
+                if (entry == nullptr || entry->Value)
+                    return false;
+
+                entry->Value = true;
+                return true;
+            }
+
+        private:
+            TPrevRange Prev;
+            TOtherRange OtherRange;
+            mutable table_t Table;
+        };
+
+        // ----------------------------------
+        // except
+        // ----------------------------------
+
+        template<typename TPrevRange, typename TOtherRange>
+        class except_range : public base_range<
+            except_range<TPrevRange, TOtherRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        private:
+            using prev_iter_t = typename TPrevRange::iterator;
+            using value_t = typename std::decay<typename prev_iter_t::output_t>::type;
+
+            static_assert(is_hashable<value_t>::value,
+                "except can only be used with element types that have a std::hash specialization."
+                );
+
+        public:
+            using iterator = set_filter_iterator<except_range, prev_iter_t>;
+
+            except_range(const TPrevRange& prev, const TOtherRange& otherRange)
+                : Prev(prev)
+                , OtherRange(otherRange)
+            {}
+
+            inline iterator begin() const
+            {
+                Excluded.clear();
+
+                for (const auto& val : OtherRange)
+                    Excluded.insert(val);
+
+                auto begin = Prev.begin();
+                return iterator(this, begin, Prev.end());
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, Prev.end(), Prev.end());
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+            // Accepts every element that is neither in the other range nor was yielded already.
+            inline bool accept(const prev_iter_t& it) const
+            {
+                return Excluded.insert(*it);
+            }
+
+        private:
+            TPrevRange Prev;
+            TOtherRange OtherRange;
+            mutable hash_set<value_t> Excluded;
+        };
+
+        // ----------------------------------
+        // repeat
+        // ----------------------------------
+
+        template<typename TPrevRange>
+        class repeat_range : public base_range<
+            repeat_range<TPrevRange>,
+            typename TPrevRange::iterator::output_t
+        >
+        {
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = typename prev_iter_t::output_t;
+
+                iterator() = default;
+
+                iterator(TPrevRange* prevRangePtr, prev_iter_t begin, prev_iter_t end, size_t count)
+                    : PrevRangePtr(prevRangePtr)
+                    , Pos(begin)
+                    , End(end)
+                    , Count(count)
+                {}
+
+                inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const iterator& o) const { return Pos != o.Pos; }
+
+                inline iterator& operator++()
+                {
+                    ++Pos;
+
+                    if (Pos == End && Count > 0)
+                    {
+                        Pos = PrevRangePtr->begin();
+                        --Count;
+                    }
+
+                    return *this;
+                }
+
+                inline output_t operator*() const
+                {
+                    return *Pos;
+                }
+
+                TPrevRange* PrevRangePtr;
+                prev_iter_t Pos;
+                prev_iter_t End;
+                size_t Count;
+            };
+
+        public:
+            repeat_range(const TPrevRange& prev, size_t count)
+                : Prev(prev)
+                , Count(count)
+            {}
+
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                return iterator(&Prev, begin, Prev.end(), Count);
+            }
+
+            inline iterator end() const
+            {
+                return iterator(&Prev, Prev.end(), Prev.end(), 0);
+            }
+
+            // The iterator restarts Count times, so the range is yielded Count + 1 times.
+            inline range_size size_hint() const
+            {
+                const range_size size = Prev.size_hint();
+                return size + size * Count;
+            }
+
+        private:
+            mutable TPrevRange Prev;
+            size_t Count;
+        };
+
+        // ----------------------------------
+        // join
+        // ----------------------------------
+
+        // Determines the output of a selection in the join range.
+        template<typename TRangeA, typename TRangeB, typename TTransform>
+        using join_output_t = typename std::result_of<TTransform(
+            typename TRangeA::iterator::output_t,
+            typename TRangeB::iterator::output_t
+            )>::type;
+
+        // Resolves the decayed key types of both sides of a join and
+        // determines whether the keys can be matched using a hash table.
+        template<typename TRangeA, typename TRangeB, typename TKeySelectorA, typename TKeySelectorB>
+        struct join_traits
+        {
+            using key_a_t = typename std::decay<
+                typename std::result_of<TKeySelectorA(typename TRangeA::iterator::output_t)>::type
+            >::type;
+
+            using key_b_t = typename std::decay<
+                typename std::result_of<TKeySelectorB(typename TRangeB::iterator::output_t)>::type
+            >::type;
+
+            static const bool use_hash =
+                std::is_same<key_a_t, key_b_t>::value &&
+                is_hashable<key_b_t>::value;
+        };
+
+        // Maps every key of a join's other range to the chain of its elements,
+        // in the order in which they appear in the other range.
+        template<typename TOtherRange, typename TKey>
+        class join_hash_index
+        {
+        public:
+            using other_range_iter_t = typename TOtherRange::iterator;
+
+            // Marks the end of a chain.
+            static const size_t npos = static_cast<size_t>(-1);
+
+            template<typename TKeySelector>
+            void build(const TOtherRange& otherRange, const TKeySelector& keySelector)
+            {
+                Table.clear();
+                Matches.clear();
+
+                for (auto pos = otherRange.begin(), end = otherRange.end(); pos != end; ++pos)
+                {
+                    const auto& key = keySelector(*pos);
+                    const size_t index = Matches.size();
+
+                    Matches.push_back(match{ pos, static_cast<size_t>(-1) });
+
+                    auto result = Table.insert(key, table_t::hash_of(key), chain{ index, index });
+
+                    if (!result.second)
+                    {
+                        // Append to the chain of the key.
+                        chain& c = result.first->Value;
+                        Matches[c.Last].Next = index;
+                        c.Last = index;
+                    }
+                }
+            }
+
+            // Returns the first match of a key, or npos if there is none.
+            inline size_t find(const TKey& key) const
+            {
+                const auto* entry = Table.find(key, table_t::hash_of(key));
+                return (entry != nullptr) ? entry->Value.First : npos;
+            }
+
+            // Returns the match that follows another one with the same key, or npos if there is none.
+            inline size_t next(size_t match) const { return Matches[match].Next; }
+
+            inline const other_range_iter_t& at(size_t match) const { return Matches[match].Pos; }
+
+        private:
+            struct chain
+            {
+                size_t First;
+                size_t Last;
+            };
+
+            struct match
+            {
+                other_range_iter_t Pos;
+                size_t Next;
+            };
+
+            using table_t = hash_table<TKey, chain>;
+
+            table_t Table;
+            std::vector<match> Matches;
+        };
+
+        // Placeholder index for joins whose keys cannot be hashed.
+        struct join_no_index
+        {
+            /* Nothing to define here. */
+        };
+
+        // Inner join operator.
+        // Builds a hash index over the other range when both key types are the same
+        // and hashable, and falls back to a nested loop otherwise. Both strategies
+        // produce the matches in the same order.
+        template<
+            typename TPrevRange, typename TOtherRange,
+            typename TKeySelectorA, typename TKeySelectorB,
+            typename TTransform
+        >
+        class join_range : public base_range<
+            join_range<TPrevRange, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform>,
+            join_output_t<TPrevRange, TOtherRange, TTransform>
+        >
+        {
+        private:
+            using other_range_iter_t = typename TOtherRange::iterator;
+            using traits = join_traits<TPrevRange, TOtherRange, TKeySelectorA, TKeySelectorB>;
+            using hash_index_t = join_hash_index<TOtherRange, typename traits::key_b_t>;
+
+            using index_t = typename std::conditional<
+                traits::use_hash, hash_index_t, join_no_index
+            >::type;
+
+        public:
+            struct nested_loop_iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = join_output_t<TPrevRange, TOtherRange, TTransform>;
+
+                nested_loop_iterator() = default;
+
+                nested_loop_iterator(prev_iter_t begin, prev_iter_t end, const join_range* parent)
+                    : Begin(begin)
+                    , End(end)
+                    , Pos(begin)
+                    , OtherBegin(parent->OtherRange.begin())
+                    , OtherEnd(parent->OtherRange.end())
+                    , OtherPos(parent->OtherRange.begin())
+                    , Parent(parent)
+                {
+                    // Find the first match without pre-incrementing the
+                    // other position, so that we start at the beginning.
+                    FindNext(false);
+                }
+
+                inline bool operator==(const nested_loop_iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const nested_loop_iterator& o) const { return Pos != o.Pos; }
+
+                inline nested_loop_iterator& operator++()
+                {
+                    // Find the next match, but pre-increment the other
+                    // position, so that we can move forward.
+                    FindNext(true);
+                    return *this;
+                }
+
+                inline output_t operator*() const
+                {
+                    const auto& transform = *Parent->Transform;
+                    return transform(*Pos, *OtherPos);
+                }
+
+                prev_iter_t Begin;
+                prev_iter_t End;
+                prev_iter_t Pos;
+
+                other_range_iter_t OtherBegin;
+                other_range_iter_t OtherEnd;
+                other_range_iter_t OtherPos;
+
+                const join_range* Parent;
+
+            private:
+                // Finds the next match in both ranges using the key selectors and == comparison.
+                void FindNext(bool preIncrementOther)
+                {
+                    const auto& keySelectorA = *Parent->KeySelectorA;
+                    const auto& keySelectorB = *Parent->KeySelectorB;
+
+                    if (preIncrementOther)
+                        ++OtherPos;
+
+                    while (Pos != End)
+                    {
+                        bool shouldContinue = true;
+                        const auto& keyA = keySelectorA(*Pos);
+
+                        while (OtherPos != OtherEnd)
+                        {
+                            const auto& keyB = keySelectorB(*OtherPos);
+
+                            if (keyA == keyB)
+                            {
+                                shouldContinue = false;
+                                break;
+                            }
+
+                            ++OtherPos;
+                        }
+
+                        // Start over in the other range if it's finished.
+                        if (OtherPos == OtherEnd)
+                            OtherPos = OtherBegin;
+
+                        if (!shouldContinue)
+                            break;
+
+                        ++Pos;
+                    }
+                }
+            };
+
+            struct hash_iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = join_output_t<TPrevRange, TOtherRange, TTransform>;
+
+                hash_iterator() = default;
+
+                hash_iterator(prev_iter_t begin, prev_iter_t end, const join_range* parent)
+                    : Pos(begin)
+                    , End(end)
+                    , Match(hash_index_t::npos)
+                    , Parent(parent)
+                {
+                    FindNext();
+                }
+
+                inline bool operator==(const hash_iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const hash_iterator& o) const { return Pos != o.Pos; }
+
+                inline hash_iterator& operator++()
+                {
+                    // Move along the chain of the current key first.
+                    Match = Parent->Index.next(Match);
+
+                    if (Match == hash_index_t::npos)
+                    {
+                        ++Pos;
+                        FindNext();
+                    }
+
+                    return *this;
+                }
+
+                inline output_t operator*() const
+                {
+                    const auto& transform = *Parent->Transform;
+                    return transform(*Pos, *Parent->Index.at(Match));
+                }
+
+                prev_iter_t Pos;
+                prev_iter_t End;
+                size_t Match;
+
+                const join_range* Parent;
+
+            private:
+                // Probes the index with the keys of our range until a match is found.
+                void FindNext()
+                {
+                    const auto& keySelectorA = *Parent->KeySelectorA;
+
+                    while (Pos != End)
+                    {
+                        Match = Parent->Index.find(keySelectorA(*Pos));
+
+                        if (Match != hash_index_t::npos)
+                            break;
+
+                        ++Pos;
+                    }
+                }
+            };
+
+            using iterator = typename std::conditional<
+                traits::use_hash, hash_iterator, nested_loop_iterator
+            >::type;
+
+        public:
+            join_range(
+                const TPrevRange& prev,
+                TOtherRange otherRange,
+                const TKeySelectorA& keySelectorA,
+                const TKeySelectorB& keySelectorB,
+                const TTransform& transform)
+                : Prev(prev)
+                , OtherRange(otherRange)
+                , KeySelectorA(&keySelectorA)
+                , KeySelectorB(&keySelectorB)
+                , Transform(&transform)
+            {}
+
+            inline iterator begin() const
+            {
+                build_index(Index);
+                auto begin = Prev.begin();
+                return iterator(begin, Prev.end(), this);
+            }
+
+            inline iterator end() const
+            {
+                return iterator(Prev.end(), Prev.end(), this);
+            }
+
+            TOtherRange OtherRange;
+            const TKeySelectorA* KeySelectorA;
+            const TKeySelectorB* KeySelectorB;
+            const TTransform* Transform;
+
+        private:
+            inline void build_index(hash_index_t& index) const
+            {
+                index.build(OtherRange, *KeySelectorB);
+            }
+
+            inline void build_index(join_no_index&) const
+            {
+                /* The nested loop does not need an index. */
+            }
+
+            TPrevRange Prev;
+            mutable index_t Index;
+        };
+
+        // ----------------------------------
+        // merge_join
+        // ----------------------------------
+
+        // Sort-merge inner join operator.
+        // Both ranges must already be sorted in ascending order by their keys, which are
+        // compared using the < operator. The ranges are walked in lockstep, and a run of
+        // equal keys in the other range is replayed for every matching element of this range.
+        // The matches are produced in the same order as by join_range.
+        template<
+            typename TPrevRange, typename TOtherRange,
+            typename TKeySelectorA, typename TKeySelectorB,
+            typename TTransform
+        >
+        class merge_join_range : public base_range<
+            merge_join_range<TPrevRange, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform>,
+            join_output_t<TPrevRange, TOtherRange, TTransform>
+        >
+        {
+        private:
+            using other_range_iter_t = typename TOtherRange::iterator;
+
+        public:
+            struct iterator
+            {
+                using prev_iter_t = typename TPrevRange::iterator;
+                using output_t = join_output_t<TPrevRange, TOtherRange, TTransform>;
+
+                iterator() = default;
+
+                iterator(
+                    prev_iter_t begin, prev_iter_t end,
+                    other_range_iter_t otherBegin, other_range_iter_t otherEnd,
+                    const merge_join_range* parent)
+                    : Pos(begin)
+                    , End(end)
+                    , OtherPos(otherBegin)
+                    , OtherEnd(otherEnd)
+                    , RunBegin(otherBegin)
+                    , Parent(parent)
                 {
-                    if (Begin != End)
+                    FindNext();
+                }
+
+                // The end iterator, which only compares Pos and never touches the other range.
+                explicit iterator(prev_iter_t end)
+                    : Pos(end)
+                    , End(end)
+                    , OtherPos()
+                    , OtherEnd()
+                    , RunBegin()
+                    , Parent(nullptr)
+                {}
+
+                inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const iterator& o) const { return Pos != o.Pos; }
+
+                inline iterator& operator++()
+                {
+                    const auto& keySelectorA = *Parent->KeySelectorA;
+                    const auto& keySelectorB = *Parent->KeySelectorB;
+
+                    ++OtherPos;
+
+                    // The other range is sorted, so its key can only be equal or greater.
+                    if (OtherPos != OtherEnd && !(keySelectorA(*Pos) < keySelectorB(*OtherPos)))
+                        return *this;
+
+                    // The run is exhausted for this element. If the next element has
+                    // the same key, FindNext() starts over at the beginning of the run.
+                    ++Pos;
+                    FindNext();
+
+                    return *this;
+                }
+
+                inline output_t operator*() const
+                {
+                    const auto& transform = *Parent->Transform;
+                    return transform(*Pos, *OtherPos);
+                }
+
+                prev_iter_t Pos;
+                prev_iter_t End;
+
+                other_range_iter_t OtherPos;
+                other_range_iter_t OtherEnd;
+
+                // The first element of the current run of equal keys in the other range.
+                other_range_iter_t RunBegin;
+
+                const merge_join_range* Parent;
+
+            private:
+                // Advances whichever range has the smaller key until both keys are equal.
+                void FindNext()
+                {
+                    const auto& keySelectorA = *Parent->KeySelectorA;
+                    const auto& keySelectorB = *Parent->KeySelectorB;
+
+                    while (Pos != End && RunBegin != OtherEnd)
                     {
-                        encounteredObjects->clear();
-                        encounteredObjects->push_back(Begin);
+                        const auto& keyA = keySelectorA(*Pos);
+                        const auto& keyB = keySelectorB(*RunBegin);
+
+                        if (keyA < keyB)
+                            ++Pos;
+                        else if (keyB < keyA)
+                            ++RunBegin;
+                        else
+                        {
+                            OtherPos = RunBegin;
+                            return;
+                        }
                     }
+
+                    // No more matches are possible.
+                    Pos = End;
                 }
+            };
+
+        public:
+            merge_join_range(
+                const TPrevRange& prev,
+                TOtherRange otherRange,
+                const TKeySelectorA& keySelectorA,
+                const TKeySelectorB& keySelectorB,
+                const TTransform& transform)
+                : OtherRange(otherRange)
+                , KeySelectorA(&keySelectorA)
+                , KeySelectorB(&keySelectorB)
+                , Transform(&transform)
+                , Prev(prev)
+            {}
+
+            // The other range is only enumerated here, since enumerating a sorting range
+            // again would sort it again and invalidate the iterators into its buffer.
+            inline iterator begin() const
+            {
+                auto begin = Prev.begin();
+                auto otherBegin = OtherRange.begin();
+                return iterator(begin, Prev.end(), otherBegin, OtherRange.end(), this);
+            }
+
+            inline iterator end() const
+            {
+                return iterator(Prev.end());
+            }
+
+            TOtherRange OtherRange;
+            const TKeySelectorA* KeySelectorA;
+            const TKeySelectorB* KeySelectorB;
+            const TTransform* Transform;
+
+        private:
+            TPrevRange Prev;
+        };
+
+        // ----------------------------------
+        // sort_buffer
+        // ----------------------------------
+
+        // Maps arithmetic sort keys to unsigned integers of the same size, which
+        // are ordered like the keys. Used to pick the radix sort at compile time.
+        template<typename TKey, typename = void>
+        struct radix_key_traits
+        {
+            static const bool is_supported = false;
+        };
+
+        template<typename TKey>
+        struct radix_key_traits<TKey, typename std::enable_if<
+            std::is_integral<TKey>::value && !std::is_same<TKey, bool>::value
+        >::type>
+        {
+            static const bool is_supported = true;
+
+            using bits_t = typename std::make_unsigned<TKey>::type;
+
+            static inline bits_t to_bits(TKey key)
+            {
+                // Flipping the sign bit moves negative values in front of positive ones.
+                const bits_t signBit = std::is_signed<TKey>::value ?
+                    static_cast<bits_t>(bits_t(1) << (sizeof(TKey) * 8 - 1)) : bits_t(0);
+
+                return static_cast<bits_t>(static_cast<bits_t>(key) ^ signBit);
+            }
+        };
+
+        template<typename TKey>
+        struct radix_key_traits<TKey, typename std::enable_if<
+            std::is_floating_point<TKey>::value &&
+            std::numeric_limits<TKey>::is_iec559 &&
+            (sizeof(TKey) == 4 || sizeof(TKey) == 8)
+        >::type>
+        {
+            static const bool is_supported = true;
+
+            using bits_t = typename std::conditional<sizeof(TKey) == 4, uint32_t, uint64_t>::type;
+
+            static inline bits_t to_bits(TKey key)
+            {
+                const bits_t signBit = bits_t(1) << (sizeof(TKey) * 8 - 1);
+
+                // -0.0 and 0.0 are equal keys.
+                if (key == TKey())
+                    key = TKey();
+
+                bits_t bits;
+                std::memcpy(&bits, &key, sizeof(bits));
+
+                // Negative values have to be inverted, because they are stored as sign and magnitude.
+                return (bits & signBit) ? ~bits : (bits | signBit);
+            }
+        };
+
+        // Determines whether the elements of a range are references into storage that
+        // outlives the enumeration, such as a container. Such elements don't have to be
+        // copied by sorting ranges.
+        template<typename TRange>
+        struct is_stable_storage : public std::false_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TContainer>
+        struct is_stable_storage<from_container_range<TContainer>> : public std::true_type
+        {
+            /* Nothing to define here. */
+        };
+
+        // Ranges that pass through references to the elements of their previous range.
+
+        template<typename TPrevRange, typename TPredicate>
+        struct is_stable_storage<where_range<TPrevRange, TPredicate>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange>
+        struct is_stable_storage<distinct_range<TPrevRange>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TKeySelector>
+        struct is_stable_storage<distinct_by_range<TPrevRange, TKeySelector>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TOtherRange>
+        struct is_stable_storage<intersect_range<TPrevRange, TOtherRange>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TOtherRange>
+        struct is_stable_storage<except_range<TPrevRange, TOtherRange>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange>
+        struct is_stable_storage<reverse_range<TPrevRange>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange>
+        struct is_stable_storage<take_range<TPrevRange>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TPredicate>
+        struct is_stable_storage<take_while_range<TPrevRange, TPredicate>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange>
+        struct is_stable_storage<skip_range<TPrevRange>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
 
-                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
-                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+        template<typename TPrevRange, typename TPredicate>
+        struct is_stable_storage<skip_while_range<TPrevRange, TPredicate>> : public is_stable_storage<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
 
-                iterator& operator++()
-                {
-                    do
-                    {
-                        ++Begin;
-                    } while (Begin != End && ContainsObject(Begin));
+        // Determines whether a sorting range can sort pointers to the elements of a range instead of copies.
+        template<typename TRange>
+        struct can_sort_indirectly : public std::integral_constant<bool,
+            is_stable_storage<TRange>::value &&
+            std::is_lvalue_reference<typename TRange::iterator::output_t>::value
+        >
+        {
+            /* Nothing to define here. */
+        };
 
-                    if (Begin != End)
-                        EncounteredObjects->push_back(Begin);
+        // Decides how a sort_buffer stores its elements: as copies, or as pointers
+        // to the elements of a range that is backed by stable storage.
+        template<typename TElement, bool IsIndirect>
+        struct sort_storage
+        {
+            using container_t = std::vector<TElement>;
+            using output_t = typename container_t::const_reference;
+
+            static inline const TElement& store(const TElement& value) { return value; }
+            static inline output_t load(const container_t& values, size_t index) { return values[index]; }
+        };
+
+        template<typename TElement>
+        struct sort_storage<TElement, true>
+        {
+            using container_t = std::vector<const TElement*>;
+            using output_t = const TElement&;
+
+            static inline const TElement* store(const TElement& value) { return &value; }
+            static inline output_t load(const container_t& values, size_t index) { return *values[index]; }
+        };
+
+        // Stores the elements of a sorting range along with their sort keys.
+        // Every key is selected once per element and sorted together with the
+        // index of its element, so comparisons never call the key selectors
+        // and the elements themselves are not moved around. Indirect buffers
+        // only store pointers to the elements, which must stay alive.
+        template<typename TElement, typename TKey, bool IsIndirect = false>
+        class sort_buffer
+        {
+        private:
+            using storage = sort_storage<TElement, IsIndirect>;
+
+        public:
+            using container_t = typename storage::container_t;
+
+            struct entry
+            {
+                TKey Key;
+                size_t Index;
+            };
+
+            using entry_container = std::vector<entry>;
+            using entry_iter_t = typename entry_container::const_iterator;
+
+            struct iterator
+            {
+                using output_t = typename storage::output_t;
+                using category = std::random_access_iterator_tag;
+
+                iterator() = default;
+
+                iterator(entry_iter_t pos, const container_t* values)
+                    : Pos(pos)
+                    , Values(values)
+                {}
+
+                inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
+                inline bool operator!=(const iterator& o) const { return Pos != o.Pos; }
+
+                inline iterator& operator++()
+                {
+                    ++Pos;
+                    return *this;
+                }
 
+                inline iterator& operator--()
+                {
+                    --Pos;
                     return *this;
                 }
 
-                bool ContainsObject(const prev_iter_t& it)
+                inline iterator& operator+=(std::ptrdiff_t n)
                 {
-                    const auto& itVal = *it;
+                    Pos += n;
+                    return *this;
+                }
 
-                    for (size_t i = 0; i < EncounteredObjects->size(); ++i)
-                        if (*EncounteredObjects->at(i) == itVal)
-                            return true;
+                inline std::ptrdiff_t operator-(const iterator& o) const { return Pos - o.Pos; }
 
-                    return false;
+                inline output_t operator*() const
+                {
+                    return storage::load(*Values, Pos->Index);
                 }
 
-                inline output_t operator*() const { return *Begin; }
+                inline output_t operator[](std::ptrdiff_t n) const
+                {
+                    return storage::load(*Values, Pos[n].Index);
+                }
 
-                prev_iter_t Begin;
-                prev_iter_t End;
-                object_container* EncounteredObjects;
+                entry_iter_t Pos;
+                const container_t* Values;
             };
 
-        public:
-            distinct_range() = default;
-
-            explicit distinct_range(const TPrevRange& prev)
-                : Prev(prev)
+            sort_buffer()
+                : IsSorted(false)
+                , SortedFirst(nullptr)
             {}
 
-            iterator begin() const
+            // Stores the elements of a range and sorts them using the keys of a sorting range.
+            // The sort is stable, so elements with equal keys keep their order.
+            template<typename TRange, typename TSortingRange>
+            void sort(const TRange& range, const TSortingRange& sorter)
             {
-                return iterator(Prev.begin(), Prev.end(), &EncounteredObjects);
+                IsSorted = false;
+                Values.clear();
+
+                const range_size size = range.size_hint();
+
+                if (size.IsExact)
+                    Values.reserve(size.Size);
+
+                for (const auto& val : range)
+                    Values.push_back(storage::store(val));
+
+                sort_values(sorter);
             }
 
-            iterator end() const
+            // Like sort(), but keeps the current elements if the buffer was already sorted by
+            // sort_cached() and not invalidated since. If the size of the range can be determined
+            // cheaply, a change of the size invalidates the buffer as well. Indirect buffers are
+            // also invalidated when the first element moved, such as after the container
+            // reallocated its storage, so that they don't point to released memory.
+            template<typename TRange, typename TSortingRange>
+            void sort_cached(const TRange& range, const TSortingRange& sorter)
             {
-                return iterator(Prev.end(), Prev.end(), &EncounteredObjects);
+                const range_size size = range.size_hint();
+                const void* first = first_address(range, std::integral_constant<bool, IsIndirect>());
+
+                if (IsSorted && (!size.IsExact || size.Size == Values.size()) && first == SortedFirst)
+                    return;
+
+                sort(range, sorter);
+                IsSorted = true;
+                SortedFirst = first;
             }
 
-        private:
-            TPrevRange Prev;
-            mutable object_container EncounteredObjects;
-        };
+            inline void invalidate()
+            {
+                IsSorted = false;
+            }
 
-        // ----------------------------------
-        // select
-        // ----------------------------------
+            // Sorts the elements that were added to values() directly.
+            template<typename TSortingRange>
+            void sort_values(const TSortingRange& sorter)
+            {
+                Entries.clear();
+                Entries.reserve(Values.size());
 
-        // Resolves the arguments that are passed to a select functor.
-        template<typename TPrevRange>
-        using select_transform_arg_t = typename std::add_const<
-            typename std::add_lvalue_reference<typename TPrevRange::iterator::output_t>::type
-        >::type;
+                for (size_t i = 0; i < Values.size(); ++i)
+                    Entries.push_back(entry{ sorter.select_key(storage::load(Values, i)), i });
 
-        // Resolves the return type of a select functor.
-        template<typename TPrevRange, typename TTransform>
-        using select_output_t = typename std::result_of<
-            TTransform(select_transform_arg_t<TPrevRange>)
-        >::type;
+                if (sorter.is_parallel())
+                    sort_entries_parallel(sorter);
+                else
+                    sort_entries(Entries.begin(), Entries.end(), sorter, radix_tag());
+            }
 
-        template<typename TPrevRange, typename TTransform>
-        class select_range : public base_range<
-            select_range<TPrevRange, TTransform>,
-            select_output_t<TPrevRange, TTransform>
-        >
-        {
-        public:
-            struct iterator
+            // Like sort(), but only keeps the first count elements. They are selected
+            // using a bounded heap, which takes O(n log count) time and O(count) memory.
+            template<typename TRange, typename TSortingRange>
+            void sort_top(const TRange& range, const TSortingRange& sorter, size_t count)
             {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = select_output_t<TPrevRange, TTransform>;
-
-                iterator() = default;
+                IsSorted = false;
+                Values.clear();
+                Entries.clear();
 
-                iterator(const select_range* parent, prev_iter_t begin, prev_iter_t end)
-                    : Parent(parent)
-                    , Begin(begin)
-                    , End(end)
-                {}
+                if (count == 0)
+                    return;
 
-                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
-                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+                struct candidate
+                {
+                    TKey Key;
+                    size_t Position;    // Position in the range, which decides between equal keys.
+                    size_t Index;       // Index into Values.
+                };
 
-                inline iterator& operator++()
+                // The heap's front is the candidate that comes last in the sort order.
+                auto comesBefore = [&sorter](const candidate& a, const candidate& b)
                 {
-                    ++Begin;
-                    return *this;
-                }
+                    if (sorter.compare_keys(a.Key, b.Key))
+                        return true;
+                    else if (sorter.compare_keys(b.Key, a.Key))
+                        return false;
 
-                inline output_t operator*() const
+                    return a.Position < b.Position;
+                };
+
+                std::vector<candidate> heap;
+                size_t position = 0;
+
+                for (const auto& val : range)
                 {
-                    const auto& transform = *Parent->Transform;
-                    return transform(*Begin);
+                    if (heap.size() < count)
+                    {
+                        Values.push_back(storage::store(val));
+                        heap.push_back(candidate{ sorter.select_key(val), position, Values.size() - 1 });
+                        std::push_heap(heap.begin(), heap.end(), comesBefore);
+                    }
+                    else
+                    {
+                        candidate c{ sorter.select_key(val), position, 0 };
+
+                        if (comesBefore(c, heap.front()))
+                        {
+                            // Replace the last candidate and reuse its slot in Values.
+                            std::pop_heap(heap.begin(), heap.end(), comesBefore);
+
+                            c.Index = heap.back().Index;
+                            Values[c.Index] = storage::store(val);
+                            heap.back() = std::move(c);
+
+                            std::push_heap(heap.begin(), heap.end(), comesBefore);
+                        }
+                    }
+
+                    ++position;
                 }
 
-                const select_range* Parent;
-                prev_iter_t Begin;
-                prev_iter_t End;
-            };
+                std::sort_heap(heap.begin(), heap.end(), comesBefore);
 
-        public:
-            select_range() = default;
+                Entries.reserve(heap.size());
 
-            select_range(const TPrevRange& prev, const TTransform& transform)
-                : Prev(prev)
-                , Transform(&transform)
-            {}
+                for (auto& c : heap)
+                    Entries.push_back(entry{ std::move(c.Key), c.Index });
+            }
+
+            inline container_t& values()
+            {
+                return Values;
+            }
+
+            // Removes all elements, but keeps the allocated memory for reuse.
+            inline void clear()
+            {
+                IsSorted = false;
+                Values.clear();
+                Entries.clear();
+            }
 
             inline iterator begin() const
             {
-                return iterator(this, Prev.begin(), Prev.end());
+                return iterator(Entries.begin(), &Values);
             }
 
             inline iterator end() const
             {
-                return iterator(this, Prev.end(), Prev.end());
+                return iterator(Entries.end(), &Values);
             }
 
         private:
-            TPrevRange Prev;
-            const TTransform* Transform;
-        };
-
-        // ----------------------------------
-        // select_many
-        // ----------------------------------
+            using entry_range_iter_t = typename entry_container::iterator;
+            using radix_tag = std::integral_constant<bool, radix_key_traits<TKey>::is_supported>;
 
-        template<typename TPrevRange, typename TTransform>
-        struct select_many_traits
-        {
-            using returned_range_t = typename std::result_of<
-                TTransform(typename TPrevRange::iterator::output_t)
-            >::type;
+            // Below this number of elements, a comparison sort beats the radix sort's passes.
+            static const size_t radix_sort_threshold = 256;
 
-            // See if the returned type is really a range.
-            static_assert(
-                std::is_base_of<base_range_ident, returned_range_t>::value,
-                "The transform function of select_many is expected to return a LINQ range."
-                );
+            // The minimum number of elements that every thread of a parallel sort receives.
+            static const size_t parallel_sort_min_run = 16384;
 
-            using output_t = typename returned_range_t::iterator::output_t;
-        };
+            template<typename TSortingRange>
+            static void sort_entries(
+                entry_range_iter_t first, entry_range_iter_t last,
+                const TSortingRange& sorter, std::false_type)
+            {
+                std::stable_sort(first, last,
+                    [&sorter](const entry& a, const entry& b)
+                {
+                    return sorter.compare_keys(a.Key, b.Key);
+                });
+            }
 
-        template<typename TPrevRange, typename TTransform>
-        class select_many_range : public base_range<
-            select_many_range<TPrevRange, TTransform>,
-            typename select_many_traits<TPrevRange, TTransform>::output_t
-        >
-        {
-        public:
-            struct iterator
+            // Stable LSD radix sort over the bytes of arithmetic keys.
+            template<typename TSortingRange>
+            static void sort_entries(
+                entry_range_iter_t first, entry_range_iter_t last,
+                const TSortingRange& sorter, std::true_type)
             {
-                using prev_iter_t = typename TPrevRange::iterator;
+                const size_t count = static_cast<size_t>(last - first);
 
-                using returned_range_t = typename select_many_traits<TPrevRange, TTransform>::returned_range_t;
-                using returned_range_iter_t = typename returned_range_t::iterator;
-                using output_t = typename returned_range_iter_t::output_t;
+                if (count < radix_sort_threshold)
+                {
+                    sort_entries(first, last, sorter, std::false_type());
+                    return;
+                }
 
-                iterator() = default;
+                using traits = radix_key_traits<TKey>;
+                using bits_t = typename traits::bits_t;
 
-                iterator(const select_many_range* parent, prev_iter_t pos, prev_iter_t end)
-                    : Parent(parent)
-                    , Pos(pos)
-                    , End(end)
-                {
-                    if (Pos != End)
-                    {
-                        const auto& transform = *Parent->Transform;
-                        bool first = true;
+                const size_t digitCount = sizeof(bits_t);
 
-                        do
-                        {
-                            if (!first)
-                                ++Pos;
+                // Inverting all bits reverses the order for descending sorts.
+                const bits_t flip = (sorter.direction() == sort_direction::descending) ?
+                    static_cast<bits_t>(~bits_t(0)) : bits_t(0);
 
-                            if (Pos == End)
-                                break;
+                // Count the occurrences of every byte value for all digits in a single pass.
+                std::vector<size_t> counts(digitCount * 256, 0);
 
-                            RetRange = transform(*Pos);
-                            RetBegin = RetRange.begin();
-                            RetEnd = RetRange.end();
+                for (auto it = first; it != last; ++it)
+                {
+                    const bits_t bits = static_cast<bits_t>(traits::to_bits(it->Key) ^ flip);
 
-                            first = false;
-                        }
-                        while (RetBegin == RetEnd);
-                    }
+                    for (size_t d = 0; d < digitCount; ++d)
+                        ++counts[d * 256 + ((bits >> (d * 8)) & 0xff)];
                 }
 
-                inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
-                inline bool operator!=(const iterator& o) const { return Pos != o.Pos; }
+                // The passes alternate between the input and this buffer.
+                entry_container buffer(first, last);
+                entry_range_iter_t from = first;
+                entry_range_iter_t to = buffer.begin();
 
-                inline iterator& operator++()
+                // Iterators of different containers can't be compared, so track where the data is.
+                bool inBuffer = false;
+
+                const bits_t firstBits = static_cast<bits_t>(traits::to_bits(first->Key) ^ flip);
+
+                for (size_t d = 0; d < digitCount; ++d)
                 {
-                    if (RetBegin != RetEnd)
+                    size_t* digitCounts = &counts[d * 256];
+
+                    // Skip digits that are equal for all keys, such as the high bytes of timestamps.
+                    if (digitCounts[(firstBits >> (d * 8)) & 0xff] == count)
+                        continue;
+
+                    size_t offset = 0;
+
+                    for (size_t i = 0; i < 256; ++i)
                     {
-                        // There are values left to be obtained from the returned range.
-                        ++RetBegin;
+                        const size_t occurrences = digitCounts[i];
+                        digitCounts[i] = offset;
+                        offset += occurrences;
                     }
 
-                    if (RetBegin == RetEnd)
+                    for (auto it = from, end = from + count; it != end; ++it)
+                    {
+                        const bits_t bits = static_cast<bits_t>(traits::to_bits(it->Key) ^ flip);
+                        to[digitCounts[(bits >> (d * 8)) & 0xff]++] = *it;
+                    }
+
+                    std::swap(from, to);
+                    inBuffer = !inBuffer;
+                }
+
+                if (inBuffer)
+                    std::copy(from, from + count, first);
+            }
+
+            // Sorts one run per thread and merges neighbouring runs until one is left.
+            // Each merge is split into pieces, so that the last rounds keep all threads busy.
+            // Only the key comparisons run on other threads, never the key selectors.
+            template<typename TSortingRange>
+            void sort_entries_parallel(const TSortingRange& sorter)
+            {
+                const size_t count = Entries.size();
+                const size_t threadCount = hardware_thread_count();
+                const size_t runCount = (std::min)(threadCount, count / parallel_sort_min_run);
+
+                if (runCount < 2)
+                {
+                    sort_entries(Entries.begin(), Entries.end(), sorter, radix_tag());
+                    return;
+                }
+
+                std::vector<size_t> bounds(runCount + 1);
+                for (size_t i = 0; i <= runCount; ++i)
+                    bounds[i] = count * i / runCount;
+
+                parallel_for(runCount, [&](size_t i)
+                {
+                    sort_entries(Entries.begin() + bounds[i], Entries.begin() + bounds[i + 1], sorter, radix_tag());
+                });
+
+                auto comesBefore = [&sorter](const entry& a, const entry& b)
+                {
+                    return sorter.compare_keys(a.Key, b.Key);
+                };
+
+                struct merge_piece
+                {
+                    size_t AFirst, ALast;
+                    size_t BFirst, BLast;
+                    size_t Out;
+                };
+
+                entry_container merged(Entries);
+                std::vector<merge_piece> pieces;
+
+                while (bounds.size() > 2)
+                {
+                    const size_t runs = bounds.size() - 1;
+                    const size_t pairCount = (runs + 1) / 2;
+                    const size_t piecesPerPair = (std::max)(size_t(1), threadCount / pairCount);
+
+                    pieces.clear();
+
+                    for (size_t p = 0; p < pairCount; ++p)
                     {
-                        // Move our parent iterator forward to get the next container.
-                        ++Pos;
-                        if (Pos != End)
+                        const size_t aFirst = bounds[2 * p];
+                        const size_t aLast = bounds[2 * p + 1];
+                        const size_t bLast = (2 * p + 2 < bounds.size()) ? bounds[2 * p + 2] : aLast;
+
+                        size_t prevA = aFirst;
+                        size_t prevB = aLast;
+
+                        for (size_t k = 1; k <= piecesPerPair; ++k)
                         {
-                            const auto& transform = *Parent->Transform;
-                            RetRange = transform(*Pos);
-                            RetBegin = RetRange.begin();
-                            RetEnd = RetRange.end();
+                            size_t splitA = aLast;
+                            size_t splitB = bLast;
+
+                            if (k < piecesPerPair)
+                            {
+                                splitA = aFirst + (aLast - aFirst) * k / piecesPerPair;
+
+                                // Elements of B that are equal to the split element come after it.
+                                if (splitA < aLast)
+                                {
+                                    splitB = static_cast<size_t>(std::lower_bound(
+                                        Entries.begin() + prevB, Entries.begin() + bLast,
+                                        Entries[splitA], comesBefore) - Entries.begin());
+                                }
+                            }
+
+                            pieces.push_back(merge_piece{ prevA, splitA, prevB, splitB, prevA + prevB - aLast });
+
+                            prevA = splitA;
+                            prevB = splitB;
                         }
                     }
 
-                    return *this;
+                    parallel_for(pieces.size(), [&](size_t i)
+                    {
+                        const merge_piece& piece = pieces[i];
+
+                        std::merge(
+                            Entries.begin() + piece.AFirst, Entries.begin() + piece.ALast,
+                            Entries.begin() + piece.BFirst, Entries.begin() + piece.BLast,
+                            merged.begin() + piece.Out,
+                            comesBefore);
+                    });
+
+                    Entries.swap(merged);
+
+                    // Every pair of runs became a single run.
+                    std::vector<size_t> mergedBounds;
+                    for (size_t i = 0; i < bounds.size(); i += 2)
+                        mergedBounds.push_back(bounds[i]);
+
+                    if (mergedBounds.back() != count)
+                        mergedBounds.push_back(count);
+
+                    bounds.swap(mergedBounds);
                 }
+            }
 
-                inline output_t operator*() const { return *RetBegin; }
+            template<typename TRange>
+            static inline const void* first_address(const TRange&, std::false_type)
+            {
+                return nullptr;
+            }
 
-                const select_many_range* Parent;
-                prev_iter_t Pos;
-                prev_iter_t End;
+            template<typename TRange>
+            static inline const void* first_address(const TRange& range, std::true_type)
+            {
+                auto begin = range.begin();
+                return (begin != range.end()) ? &*begin : nullptr;
+            }
 
-                returned_range_t RetRange;
-                returned_range_iter_t RetBegin;
-                returned_range_iter_t RetEnd;
-            };
+            container_t Values;
+            entry_container Entries;
+
+            // Whether the buffer holds the result of sort_cached(), and the address of the
+            // first element that it was sorted from (see first_address).
+            bool IsSorted;
+            const void* SortedFirst;
+        };
+
+        // ----------------------------------
+        // order_by
+        // ----------------------------------
 
+        template<typename TPrevRange, typename TKeySelector>
+        class order_by_range : public base_range<
+            order_by_range<TPrevRange, TKeySelector>,
+            typename TPrevRange::iterator::output_t
+        >, public sorting_range
+        {
         public:
-            select_many_range() = default;
+            using container_element_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
 
-            select_many_range(const TPrevRange& prev, const TTransform& transform)
+            using key_t = typename std::decay<
+                typename std::result_of<TKeySelector(const container_element_t&)>::type
+            >::type;
+
+            using buffer_t = sort_buffer<container_element_t, key_t, can_sort_indirectly<TPrevRange>::value>;
+            using iterator = typename buffer_t::iterator;
+
+            // The range whose elements are sorted.
+            using source_range_t = TPrevRange;
+
+            order_by_range(const TPrevRange& prev, const TKeySelector& keySelector, sort_direction sortDir, bool isParallel)
                 : Prev(prev)
-                , Transform(&transform)
+                , KeySelector(&keySelector)
+                , SortDirection(sortDir)
+                , IsParallel(isParallel)
             {}
 
             inline iterator begin() const
             {
-                return iterator(this, Prev.begin(), Prev.end());
+                if (Cache)
+                {
+                    Cache->sort_cached(Prev, *this);
+                    return Cache->begin();
+                }
+
+                SortedValues.sort(Prev, *this);
+                return SortedValues.begin();
+            }
+
+            // Only sorts the first count elements (used by take_range).
+            inline iterator begin_top(size_t count) const
+            {
+                if (Cache)
+                    return begin();
+
+                SortedValues.sort_top(Prev, *this, count);
+                return SortedValues.begin();
             }
 
             inline iterator end() const
             {
-                return iterator(this, Prev.end(), Prev.end());
+                return Cache ? Cache->end() : SortedValues.end();
+            }
+
+            // The front of the elements that the last begin() or begin_top() sorted,
+            // without sorting them again.
+            inline iterator filled_begin() const
+            {
+                return Cache ? Cache->begin() : SortedValues.begin();
+            }
+
+            inline range_size size_hint() const
+            {
+                return Prev.size_hint();
+            }
+
+            inline const source_range_t& source() const
+            {
+                return Prev;
+            }
+
+            inline key_t select_key(const container_element_t& value) const
+            {
+                const auto& keySelector = *KeySelector;
+                return keySelector(value);
+            }
+
+            inline bool compare_keys(const key_t& a, const key_t& b) const
+            {
+                return (SortDirection == sort_direction::ascending)?
+                     (a < b) : /*descending:*/ (b < a);
+            }
+
+            inline sort_direction direction() const
+            {
+                return SortDirection;
+            }
+
+            inline bool is_parallel() const
+            {
+                return IsParallel;
+            }
+
+            // Returns a copy of this range that keeps its sorted elements between enumerations.
+            // The sorted elements are shared by all copies of the returned range, including the
+            // ones that later operators store, so they are sorted once for all of them. They are
+            // sorted again after invalidate() was called, or when the size of the source changed
+            // (only detected for sources that know their size, such as containers) or its
+            // elements were moved (see sort_buffer::sort_cached()). Other modifications of the
+            // source require a call to invalidate().
+            inline order_by_range cached() const
+            {
+                order_by_range copy(*this);
+                copy.Cache = std::make_shared<buffer_t>();
+                return copy;
+            }
+
+            // Makes a cached range sort its elements again in the next enumeration.
+            inline void invalidate() const
+            {
+                if (Cache)
+                    Cache->invalidate();
             }
 
         private:
             TPrevRange Prev;
-            const TTransform* Transform;
+            const TKeySelector* KeySelector;
+            sort_direction SortDirection;
+            bool IsParallel;
+            mutable buffer_t SortedValues;
+
+            // The sorted elements of a cached range.
+            std::shared_ptr<buffer_t> Cache;
         };
 
         // ----------------------------------
-        // reverse
+        // then_by
         // ----------------------------------
 
-        template<typename TPrevRange>
-        class reverse_range : public base_range<
-            reverse_range<TPrevRange>,
+        template<typename TPrevRange, typename TKeySelector>
+        class then_by_range : public base_range<
+            then_by_range<TPrevRange, TKeySelector>,
             typename TPrevRange::iterator::output_t
-        >
+        >, public sorting_range
         {
-        private:
-            using prev_iter_t = typename TPrevRange::iterator;
-            using object_container = std::vector<prev_iter_t>;
+            static_assert(std::is_assignable<sorting_range, TPrevRange>::value,
+                "A then_by operation can only be appended to another then_by or order_by operation."
+                );
 
         public:
-            struct iterator
-            {
-                using output_t = typename prev_iter_t::output_t;
+            using container_element_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
 
-                iterator() = default;
+            using my_key_t = typename std::decay<
+                typename std::result_of<TKeySelector(const container_element_t&)>::type
+            >::type;
 
-                iterator(const object_container* prevIterators, size_t index)
-                    : PrevIterators(prevIterators)
-                    , Index(index)
-                {}
+            // The keys of all previous sorting ranges, followed by our own key.
+            // They are compared lexicographically by compare_keys.
+            using key_t = std::pair<typename TPrevRange::key_t, my_key_t>;
 
-                inline bool operator==(const iterator& o) const { return Index == o.Index; }
-                inline bool operator!=(const iterator& o) const { return Index != o.Index; }
+            // The range before the order_by that started the chain of sorting ranges.
+            using source_range_t = typename TPrevRange::source_range_t;
 
-                inline iterator& operator++()
+            using buffer_t = sort_buffer<container_element_t, key_t, can_sort_indirectly<source_range_t>::value>;
+            using iterator = typename buffer_t::iterator;
+
+            then_by_range(const TPrevRange& prev, const TKeySelector& keySelector, sort_direction sortDir)
+                : Prev(prev)
+                , KeySelector(&keySelector)
+                , SortDirection(sortDir)
+            {}
+
+            inline iterator begin() const
+            {
+                // The previous sorting ranges only contribute their keys, so the
+                // whole chain sorts the unsorted source once.
+                if (Cache)
                 {
-                    --Index;
-                    return *this;
+                    Cache->sort_cached(source(), *this);
+                    return Cache->begin();
                 }
 
-                inline output_t operator*() const { return *PrevIterators->at(Index); }
+                SortedValues.sort(source(), *this);
+                return SortedValues.begin();
+            }
 
-                const object_container* PrevIterators;
-                size_t Index;
-            };
+            // Only sorts the first count elements (used by take_range).
+            inline iterator begin_top(size_t count) const
+            {
+                if (Cache)
+                    return begin();
 
-        public:
-            reverse_range() = default;
+                SortedValues.sort_top(source(), *this, count);
+                return SortedValues.begin();
+            }
 
-            explicit reverse_range(const TPrevRange& prev)
-                : Prev(prev)
-            {}
+            inline iterator end() const
+            {
+                return Cache ? Cache->end() : SortedValues.end();
+            }
 
-            inline iterator begin() const
+            // The front of the elements that the last begin() or begin_top() sorted,
+            // without sorting them again.
+            inline iterator filled_begin() const
             {
-                PrevIterators.clear();
-                
-                for (auto beg = Prev.begin(), end = Prev.end(); beg != end; ++beg)
-                    PrevIterators.push_back(beg);
+                return Cache ? Cache->begin() : SortedValues.begin();
+            }
 
-                return iterator(&PrevIterators, PrevIterators.size() - 1);
+            inline range_size size_hint() const
+            {
+                return Prev.size_hint();
             }
 
-            inline iterator end() const
+            inline const source_range_t& source() const
+            {
+                return Prev.source();
+            }
+
+            inline key_t select_key(const container_element_t& value) const
+            {
+                const auto& keySelector = *KeySelector;
+                return key_t(Prev.select_key(value), keySelector(value));
+            }
+
+            inline bool compare_keys(const key_t& a, const key_t& b) const
+            {
+                if (Prev.compare_keys(a.first, b.first))
+                    return true;
+                else if (Prev.compare_keys(b.first, a.first))
+                    return false;
+
+                return (SortDirection == sort_direction::ascending)?
+                     (a.second < b.second) : /*descending:*/ (b.second < a.second);
+            }
+
+            // A chain of sorting ranges is sorted in parallel if its order_by requested it.
+            inline bool is_parallel() const
+            {
+                return Prev.is_parallel();
+            }
+
+            // See order_by_range::cached().
+            inline then_by_range cached() const
             {
-                return iterator(nullptr, -1);
+                then_by_range copy(*this);
+                copy.Cache = std::make_shared<buffer_t>();
+                return copy;
+            }
+
+            inline void invalidate() const
+            {
+                if (Cache)
+                    Cache->invalidate();
             }
 
         private:
             TPrevRange Prev;
-            mutable object_container PrevIterators;
+            const TKeySelector* KeySelector;
+            sort_direction SortDirection;
+
+            mutable buffer_t SortedValues;
+            std::shared_ptr<buffer_t> Cache;
         };
 
         // ----------------------------------
-        // take
+        // order_by_external
         // ----------------------------------
 
-        template<typename TPrevRange>
-        class take_range : public base_range<
-            take_range<TPrevRange>,
+        // Sorts ranges that do not fit into memory.
+        // The elements are collected in runs of at most MemoryBudget bytes (including their
+        // sort keys and the scratch space of the sort). Every full run is sorted and written
+        // to a temporary file, while the last run stays in memory. Runs are merged in levels:
+        // as soon as merge_fan_in runs of the same level exist, they are merged into one run
+        // of the next level, so every element is rewritten once per level. Iterating then
+        // merges the remaining runs. Every iterator that is returned by begin() owns its runs,
+        // so enumerations don't interfere with each other. If a temporary file can't be
+        // written, the enumeration yields no elements and failed() returns true. If it can't
+        // be read while merging, the enumeration ends early and failed() returns true as well.
+        template<typename TPrevRange, typename TKeySelector>
+        class order_by_external_range : public base_range<
+            order_by_external_range<TPrevRange, TKeySelector>,
             typename TPrevRange::iterator::output_t
         >
         {
         public:
-            struct iterator
+            using container_element_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
+
+            static_assert(std::is_trivially_copyable<container_element_t>::value,
+                "order_by_external can only sort trivially copyable types, because it writes them to files as they are."
+                );
+
+            using key_t = typename std::decay<
+                typename std::result_of<TKeySelector(const container_element_t&)>::type
+            >::type;
+
+        private:
+            using buffer_t = sort_buffer<container_element_t, key_t>;
+
+            using element_storage_t = typename std::aligned_storage<
+                sizeof(container_element_t),
+                std::alignment_of<container_element_t>::value
+            >::type;
+
+            // The number of runs of one level that are merged into a run of the next level.
+            static const size_t merge_fan_in = 16;
+
+            struct run
             {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = typename prev_iter_t::output_t;
+                std::FILE* File;        // nullptr for the run that is kept in memory.
+                std::string Path;       // Empty for anonymous temporary files.
+                size_t Level;           // The number of merges that produced the run.
+                element_storage_t Current;
+            };
 
-                iterator() = default;
+            struct heap_item
+            {
+                key_t Key;
+                size_t Run;
+            };
 
-                iterator(prev_iter_t begin, size_t count)
-                    : Begin(begin)
-                    , Count(count)
+            // The runs of an enumeration. Closes and removes the temporary files when destroyed.
+            class merge_state
+            {
+            public:
+                explicit merge_state(const order_by_external_range* parent)
+                    : Parent(parent)
+                    , ReadFailed(false)
                 {}
 
-                inline bool operator==(const iterator& o) const { return Count == o.Count || Begin == o.Begin; }
-                inline bool operator!=(const iterator& o) const { return Count != o.Count && Begin != o.Begin; }
-
-                inline iterator& operator++()
+                ~merge_state()
                 {
-                    ++Begin;
-                    --Count;
-                    return *this;
+                    for (auto& r : Runs)
+                        if (r.File != nullptr)
+                            close_run(r);
                 }
 
-                inline output_t operator*() const { return *Begin; }
+                merge_state(const merge_state&) = delete;
+                merge_state& operator=(const merge_state&) = delete;
 
-                prev_iter_t Begin;
-                size_t Count;
-            };
+                // Sorts the elements of the previous range into runs and prepares merging them.
+                // Returns false if a run could not be written.
+                bool fill()
+                {
+                    // The sort needs an entry per element, plus the same again as scratch space.
+                    const size_t elementSize = sizeof(container_element_t) + 2 * sizeof(typename buffer_t::entry);
+                    const size_t runCapacity = (std::max)(size_t(1), Parent->MemoryBudget / elementSize);
 
-        public:
-            take_range() = default;
+                    auto& values = Tail.values();
+                    values.reserve(runCapacity);
 
-            take_range(const TPrevRange& prev, size_t count)
-                : Prev(prev)
-                , Count(count)
-            {}
+                    for (const auto& val : Parent->Prev)
+                    {
+                        values.push_back(val);
 
-            inline iterator begin() const
-            {
-                return iterator(Prev.begin(), Count);
-            }
+                        if (values.size() >= runCapacity && !spill())
+                            return false;
+                    }
 
-            inline iterator end() const
-            {
-                return iterator(Prev.end(), 0);
-            }
+                    Tail.sort_values(*Parent);
+                    TailPos = Tail.begin();
 
-        private:
-            TPrevRange Prev;
-            size_t Count;
-        };
+                    // The in-memory run is the last one, so that it wins ties against
+                    // the runs that were written before it.
+                    Runs.push_back(run());
+
+                    for (size_t i = 0; i < Runs.size(); ++i)
+                        push_run(i);
+
+                    return !ReadFailed;
+                }
+
+                inline bool empty() const
+                {
+                    return Heap.empty();
+                }
+
+                void advance()
+                {
+                    std::pop_heap(Heap.begin(), Heap.end(), heap_order());
+                    const size_t index = Heap.back().Run;
+                    Heap.pop_back();
+
+                    push_run(index);
+                }
+
+                inline const container_element_t& current() const
+                {
+                    return element_of(Runs[Heap.front().Run]);
+                }
+
+            private:
+                // Sorts the elements that were collected so far and writes them to a
+                // new temporary file. Returns false if the file could not be written.
+                bool spill()
+                {
+                    run r;
+                    r.Level = 0;
 
-        // ----------------------------------
-        // take_while
-        // ----------------------------------
+                    if (!open_run(r))
+                        return false;
 
-        template<typename TPrevRange, typename TPredicate>
-        class take_while_range : public base_range<
-            take_while_range<TPrevRange, TPredicate>,
-            typename TPrevRange::iterator::output_t
-        >
-        {
-        public:
-            struct iterator
-            {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = typename prev_iter_t::output_t;
+                    Tail.sort_values(*Parent);
 
-                iterator() = default;
+                    bool written = true;
 
-                iterator(const take_while_range* parent, prev_iter_t begin, prev_iter_t end)
-                    : Parent(parent)
-                    , Begin(begin)
-                    , End(end)
-                {
-                    const auto& pred = *Parent->Predicate;
-                    if (Begin != End && !pred(*Begin))
+                    for (auto it = Tail.begin(), end = Tail.end(); written && it != end; ++it)
                     {
-                        Begin = End;
+                        const container_element_t value = *it;
+                        written = (std::fwrite(&value, sizeof(value), 1, r.File) == 1);
                     }
-                }
 
-                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
-                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+                    if (!finish_run(r, written))
+                        return false;
 
-                inline iterator& operator++()
-                {
-                    ++Begin;
+                    Runs.push_back(r);
+                    Tail.clear();
 
-                    const auto& pred = *Parent->Predicate;
-                    if (Begin != End && !pred(*Begin))
-                        Begin = End;
+                    // Merge the newest runs while merge_fan_in of them share a level.
+                    while (Runs.size() >= merge_fan_in)
+                    {
+                        const size_t first = Runs.size() - merge_fan_in;
 
-                    return *this;
+                        if (Runs[first].Level != Runs.back().Level)
+                            break;
+
+                        if (!merge_runs(first))
+                            return false;
+                    }
+
+                    return true;
                 }
 
-                inline output_t operator*() const { return *Begin; }
+                // Merges the runs from first to the last one into a single run of the next level.
+                bool merge_runs(size_t first)
+                {
+                    run merged;
+                    merged.Level = Runs[first].Level + 1;
 
-                const take_while_range* Parent;
-                prev_iter_t Begin;
-                prev_iter_t End;
-            };
+                    if (!open_run(merged))
+                        return false;
 
-        public:
-            take_while_range() = default;
+                    Heap.clear();
 
-            take_while_range(const TPrevRange& prev, const TPredicate& predicate)
-                : Prev(prev)
-                , Predicate(&predicate)
-            {}
+                    for (size_t i = first; i < Runs.size(); ++i)
+                        push_run(i);
 
-            inline iterator begin() const
-            {
-                return iterator(this, Prev.begin(), Prev.end());
-            }
+                    bool written = true;
 
-            inline iterator end() const
-            {
-                return iterator(this, Prev.end(), Prev.end());
-            }
+                    while (written && !Heap.empty())
+                    {
+                        written = (std::fwrite(&current(), sizeof(container_element_t), 1, merged.File) == 1);
+                        advance();
+                    }
 
-        private:
-            TPrevRange Prev;
-            const TPredicate* Predicate;
-        };
+                    written = written && !ReadFailed;
+                    Heap.clear();
 
-        // ----------------------------------
-        // skip
-        // ----------------------------------
+                    if (!finish_run(merged, written))
+                        return false;
 
-        template<typename TPrevRange>
-        class skip_range : public base_range<
-            skip_range<TPrevRange>,
-            typename TPrevRange::iterator::output_t
-        >
-        {
-        public:
-            struct iterator
-            {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = typename prev_iter_t::output_t;
+                    for (size_t i = first; i < Runs.size(); ++i)
+                        close_run(Runs[i]);
 
-                iterator() = default;
+                    Runs.resize(first);
+                    Runs.push_back(merged);
 
-                iterator(prev_iter_t begin, prev_iter_t end, size_t count)
-                    : Begin(begin)
+                    return true;
+                }
+
+                // Creates the temporary file of a new run.
+                bool open_run(run& r) const
                 {
-                    while (Begin != end && count > 0)
+                    r.File = nullptr;
+
+                    if (Parent->TempDirectory.empty())
+                        r.File = std::tmpfile();
+                    else
                     {
-                        ++Begin;
-                        --count;
+                        r.Path = make_temp_path();
+                        r.File = std::fopen(r.Path.c_str(), "w+b");
                     }
+
+                    return r.File != nullptr;
                 }
 
-                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
-                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
+                // Prepares a written run for reading, or discards it if writing failed.
+                static bool finish_run(run& r, bool written)
+                {
+                    if (written)
+                        written = (std::fflush(r.File) == 0 && std::fseek(r.File, 0, SEEK_SET) == 0);
 
-                inline iterator& operator++()
+                    if (!written)
+                        close_run(r);
+
+                    return written;
+                }
+
+                static void close_run(run& r)
                 {
-                    ++Begin;
-                    return *this;
+                    std::fclose(r.File);
+                    r.File = nullptr;
+
+                    if (!r.Path.empty())
+                        std::remove(r.Path.c_str());
                 }
 
-                inline output_t operator*() const { return *Begin; }
+                std::string make_temp_path() const
+                {
+                    static std::atomic<unsigned> counter(0);
 
-                prev_iter_t Begin;
-            };
+                    const std::string& directory = Parent->TempDirectory;
+                    std::random_device device;
+                    char name[64];
 
-        public:
-            skip_range(const TPrevRange& prev, size_t count)
-                : Prev(prev)
-                , Count(count)
-            {}
+                    std::snprintf(name, sizeof(name), "linq11-%08x%08x-%u.tmp",
+                        static_cast<unsigned>(device()), static_cast<unsigned>(device()), counter++);
 
-            inline iterator begin() const
-            {
-                return iterator(Prev.begin(), Prev.end(), Count);
-            }
+                    const char last = directory[directory.size() - 1];
+                    const bool hasSeparator = (last == '/' || last == '\\');
 
-            inline iterator end() const
-            {
-                return iterator(Prev.end(), Prev.end(), 0);
-            }
+                    return directory + (hasSeparator ? "" : "/") + name;
+                }
 
-        private:
-            TPrevRange Prev;
-            size_t Count;
-        };
+                // Reads the next element of a run and pushes it onto the merge heap.
+                void push_run(size_t index)
+                {
+                    run& r = Runs[index];
 
-        // ----------------------------------
-        // skip_while
-        // ----------------------------------
+                    if (r.File != nullptr)
+                    {
+                        if (std::fread(&r.Current, sizeof(container_element_t), 1, r.File) != 1)
+                        {
+                            // Either the end of the run, or an error that ends the enumeration.
+                            if (std::ferror(r.File))
+                            {
+                                ReadFailed = true;
+                                Parent->Failed = true;
+                                Heap.clear();
+                            }
 
-        template<typename TPrevRange, typename TPredicate>
-        class skip_while_range : public base_range<
-            skip_while_range<TPrevRange, TPredicate>,
-            typename TPrevRange::iterator::output_t
-        >
-        {
-        public:
-            struct iterator
-            {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = typename prev_iter_t::output_t;
+                            return;
+                        }
+                    }
+                    else
+                    {
+                        if (TailPos == Tail.end())
+                            return;
 
-                iterator() = default;
+                        const container_element_t value = *TailPos;
+                        std::memcpy(&r.Current, &value, sizeof(value));
+                        ++TailPos;
+                    }
 
-                iterator(prev_iter_t begin, prev_iter_t end, const TPredicate& predicate)
-                    : Begin(begin)
-                {
-                    while (Begin != end && predicate(*Begin))
-                        ++Begin;
+                    Heap.push_back(heap_item{ Parent->select_key(element_of(r)), index });
+                    std::push_heap(Heap.begin(), Heap.end(), heap_order());
                 }
 
-                inline bool operator==(const iterator& o) const { return Begin == o.Begin; }
-                inline bool operator!=(const iterator& o) const { return Begin != o.Begin; }
-
-                inline iterator& operator++()
+                static inline const container_element_t& element_of(const run& r)
                 {
-                    ++Begin;
-                    return *this;
+                    return *reinterpret_cast<const container_element_t*>(&r.Current);
                 }
 
-                inline output_t operator*() const { return *Begin; }
-
-                prev_iter_t Begin;
-            };
+                // Orders the heap so that its front is the next element. Ties go to
+                // the earlier run, which keeps the sort stable.
+                struct heap_order_t
+                {
+                    const order_by_external_range* Parent;
 
-        public:
-            skip_while_range(const TPrevRange& prev, const TPredicate& predicate)
-                : Prev(prev)
-                , Predicate(&predicate)
-            {}
+                    inline bool operator()(const heap_item& a, const heap_item& b) const
+                    {
+                        if (Parent->compare_keys(b.Key, a.Key))
+                            return true;
+                        else if (Parent->compare_keys(a.Key, b.Key))
+                            return false;
 
-            inline iterator begin() const
-            {
-                return iterator(Prev.begin(), Prev.end(), *Predicate);
-            }
+                        return a.Run > b.Run;
+                    }
+                };
 
-            inline iterator end() const
-            {
-                return iterator(Prev.end(), Prev.end(), *Predicate);
-            }
+                inline heap_order_t heap_order() const
+                {
+                    return heap_order_t{ Parent };
+                }
 
-        private:
-            TPrevRange Prev;
-            const TPredicate* Predicate;
-        };
+                const order_by_external_range* Parent;
+                std::vector<run> Runs;
+                std::vector<heap_item> Heap;
 
-        // ----------------------------------
-        // append
-        // ----------------------------------
+                // The last run, which is not written to a file.
+                buffer_t Tail;
+                typename buffer_t::iterator TailPos;
 
-        template<typename TPrevRange, typename TOtherRange>
-        class append_range : public base_range<
-            append_range<TPrevRange, TOtherRange>,
-            typename TPrevRange::iterator::output_t
-        >
-        {
-        private:
-            using other_range_iter_t = typename TOtherRange::iterator;
+                bool ReadFailed;
+            };
 
         public:
+            // Owns the runs of its enumeration, which copies of the iterator share.
+            // end() is represented by a null state.
             struct iterator
             {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = typename prev_iter_t::output_t;
+                using output_t = const container_element_t&;
 
                 iterator() = default;
 
-                iterator(prev_iter_t begin, prev_iter_t end, other_range_iter_t otherBegin, other_range_iter_t otherEnd)
-                    : MyBegin(begin)
-                    , MyEnd(end)
-                    , OtherBegin(otherBegin)
-                    , OtherEnd(otherEnd)
+                explicit iterator(std::shared_ptr<merge_state> state)
+                    : State((state && !state->empty()) ? std::move(state) : nullptr)
                 {}
 
-                inline bool operator==(const iterator& o) const { return OtherBegin == o.OtherBegin; }
-                inline bool operator!=(const iterator& o) const { return OtherBegin != o.OtherBegin; }
+                inline bool operator==(const iterator& o) const { return State == o.State; }
+                inline bool operator!=(const iterator& o) const { return State != o.State; }
 
                 inline iterator& operator++()
                 {
-                    if (MyBegin != MyEnd)
-                        ++MyBegin;
-                    else
-                        ++OtherBegin;
+                    State->advance();
+
+                    if (State->empty())
+                        State.reset();
 
                     return *this;
                 }
 
                 inline output_t operator*() const
                 {
-                    return (MyBegin != MyEnd) ? *MyBegin : *OtherBegin;
+                    return State->current();
                 }
 
-                prev_iter_t MyBegin;
-                prev_iter_t MyEnd;
-                other_range_iter_t OtherBegin;
-                other_range_iter_t OtherEnd;
+                std::shared_ptr<merge_state> State;
             };
 
-        public:
-            append_range(const TPrevRange& prev, const TOtherRange& otherRange)
+            order_by_external_range(
+                const TPrevRange& prev,
+                const TKeySelector& keySelector,
+                sort_direction sortDir,
+                size_t memoryBudget,
+                const std::string& tempDirectory)
                 : Prev(prev)
-                , OtherRange(otherRange)
+                , KeySelector(&keySelector)
+                , SortDirection(sortDir)
+                , MemoryBudget(memoryBudget)
+                , TempDirectory(tempDirectory)
+                , Failed(false)
             {}
 
-            inline iterator begin() const
+            iterator begin() const
             {
-                return iterator(Prev.begin(), Prev.end(), OtherRange.begin(), OtherRange.end());
+                std::shared_ptr<merge_state> state = std::make_shared<merge_state>(this);
+                Failed = !state->fill();
+
+                return Failed ? iterator() : iterator(std::move(state));
             }
 
             inline iterator end() const
             {
-                return iterator(Prev.end(), Prev.end(), OtherRange.end(), OtherRange.end());
+                return iterator();
+            }
+
+            // Only an upper bound, since a failed enumeration yields no elements.
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
+
+            // Returns whether the last enumeration failed to write or read a temporary file.
+            inline bool failed() const
+            {
+                return Failed;
+            }
+
+            inline key_t select_key(const container_element_t& value) const
+            {
+                const auto& keySelector = *KeySelector;
+                return keySelector(value);
+            }
+
+            inline bool compare_keys(const key_t& a, const key_t& b) const
+            {
+                return (SortDirection == sort_direction::ascending)?
+                     (a < b) : /*descending:*/ (b < a);
+            }
+
+            inline sort_direction direction() const
+            {
+                return SortDirection;
+            }
+
+            inline bool is_parallel() const
+            {
+                return false;
             }
 
         private:
             TPrevRange Prev;
-            TOtherRange OtherRange;
+            const TKeySelector* KeySelector;
+            sort_direction SortDirection;
+            size_t MemoryBudget;
+            std::string TempDirectory;
+            mutable bool Failed;
         };
 
         // ----------------------------------
-        // repeat
+        // group_by
         // ----------------------------------
 
-        template<typename TPrevRange>
-        class repeat_range : public base_range<
-            repeat_range<TPrevRange>,
-            typename TPrevRange::iterator::output_t
+        template<typename TPrevRange, typename TKeySelector>
+        struct group_by_traits
+        {
+            using element_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
+            using key_t = typename std::decay<
+                typename std::result_of<TKeySelector(const element_t&)>::type
+            >::type;
+        };
+
+        // A group of a group_by_range: the elements with the same key, in the order of the source.
+        // Groups refer to the buffers of their group_by_range, so they are only valid until it is
+        // enumerated again or destroyed.
+        template<typename TGroupBy>
+        class grouping_range : public base_range<
+            grouping_range<TGroupBy>,
+            typename TGroupBy::element_output_t
         >
         {
         public:
             struct iterator
             {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = typename prev_iter_t::output_t;
+                using output_t = typename TGroupBy::element_output_t;
+                using category = std::random_access_iterator_tag;
 
                 iterator() = default;
 
-                iterator(TPrevRange* prevRangePtr, prev_iter_t begin, prev_iter_t end, size_t count)
-                    : PrevRangePtr(prevRangePtr)
-                    , Pos(begin)
-                    , End(end)
-                    , Count(count)
+                iterator(const TGroupBy* parent, const size_t* pos)
+                    : Parent(parent)
+                    , Pos(pos)
                 {}
 
                 inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
@@ -1190,308 +5099,262 @@ namespace linq
                 inline iterator& operator++()
                 {
                     ++Pos;
+                    return *this;
+                }
 
-                    if (Pos == End && Count > 0)
-                    {
-                        Pos = PrevRangePtr->begin();
-                        --Count;
-                    }
-
+                inline iterator& operator--()
+                {
+                    --Pos;
                     return *this;
                 }
 
-                inline output_t operator*() const
+                inline iterator& operator+=(std::ptrdiff_t n)
                 {
-                    return *Pos;
+                    Pos += n;
+                    return *this;
                 }
 
-                TPrevRange* PrevRangePtr;
-                prev_iter_t Pos;
-                prev_iter_t End;
-                size_t Count;
+                inline std::ptrdiff_t operator-(const iterator& o) const { return Pos - o.Pos; }
+
+                inline output_t operator*() const { return Parent->element(*Pos); }
+                inline output_t operator[](std::ptrdiff_t n) const { return Parent->element(Pos[n]); }
+
+                const TGroupBy* Parent;
+                const size_t* Pos;
             };
 
         public:
-            repeat_range(const TPrevRange& prev, size_t count)
-                : Prev(prev)
-                , Count(count)
+            grouping_range() = default;
+
+            grouping_range(const TGroupBy* parent, size_t group)
+                : Parent(parent)
+                , Group(group)
             {}
 
             inline iterator begin() const
             {
-                return iterator(&Prev, Prev.begin(), Prev.end(), Count);
+                return iterator(Parent, Parent->group_begin(Group));
             }
 
             inline iterator end() const
             {
-                return iterator(&Prev, Prev.end(), Prev.end(), 0);
+                return iterator(Parent, Parent->group_end(Group));
             }
 
-        private:
-            mutable TPrevRange Prev;
-            size_t Count;
-        };
+            inline range_size size_hint() const
+            {
+                return range_size(Parent->group_end(Group) - Parent->group_begin(Group), true);
+            }
 
-        // ----------------------------------
-        // join
-        // ----------------------------------
+            inline const typename TGroupBy::key_t& key() const
+            {
+                return Parent->group_key(Group);
+            }
 
-        // Determines the output of a selection in the join range.
-        template<typename TRangeA, typename TRangeB, typename TTransform>
-        using join_output_t = typename std::result_of<TTransform(
-            typename TRangeA::iterator::output_t,
-            typename TRangeB::iterator::output_t
-            )>::type;
+        private:
+            const TGroupBy* Parent;
+            size_t Group;
+        };
 
-        // Nested loop inner join operator.
-        template<
-            typename TPrevRange, typename TOtherRange,
-            typename TKeySelectorA, typename TKeySelectorB,
-            typename TTransform
-        >
-        class join_range : public base_range<
-            join_range<TPrevRange, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform>,
-            join_output_t<TPrevRange, TOtherRange, TTransform>
+        // Groups the elements by key, in the order in which the keys first occur.
+        // The elements are stored once (or referenced, see can_sort_indirectly), and every
+        // group is a slice of a single index array, so groups don't allocate memory of their own.
+        template<typename TPrevRange, typename TKeySelector>
+        class group_by_range : public base_range<
+            group_by_range<TPrevRange, TKeySelector>,
+            grouping_range<group_by_range<TPrevRange, TKeySelector>>
         >
         {
         private:
-            using other_range_iter_t = typename TOtherRange::iterator;
+            using traits = group_by_traits<TPrevRange, TKeySelector>;
+            using element_t = typename traits::element_t;
+            using storage = sort_storage<element_t, can_sort_indirectly<TPrevRange>::value>;
 
         public:
+            using key_t = typename traits::key_t;
+            using element_output_t = typename storage::output_t;
+            using group_t = grouping_range<group_by_range>;
+
+            static_assert(is_hashable<key_t>::value, "group_by requires keys that are supported by std::hash.");
+
             struct iterator
             {
-                using prev_iter_t = typename TPrevRange::iterator;
-                using output_t = join_output_t<TPrevRange, TOtherRange, TTransform>;
+                using output_t = group_t;
+                using category = std::random_access_iterator_tag;
 
                 iterator() = default;
 
-                iterator(prev_iter_t begin, prev_iter_t end, const join_range* parent)
-                    : Begin(begin)
-                    , End(end)
-                    , Pos(begin)
-                    , OtherBegin(parent->OtherRange.begin())
-                    , OtherEnd(parent->OtherRange.end())
-                    , OtherPos(parent->OtherRange.begin())
-                    , Parent(parent)
-                {
-                    // Find the first match without pre-incrementing the
-                    // other position, so that we start at the beginning.
-                    FindNext(false);
-                }
+                iterator(const group_by_range* parent, size_t group)
+                    : Parent(parent)
+                    , Group(group)
+                {}
 
-                inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
-                inline bool operator!=(const iterator& o) const { return Pos != o.Pos; }
+                inline bool operator==(const iterator& o) const { return Group == o.Group; }
+                inline bool operator!=(const iterator& o) const { return Group != o.Group; }
 
                 inline iterator& operator++()
                 {
-                    // Find the next match, but pre-increment the other
-                    // position, so that we can move forward.
-                    FindNext(true);
+                    ++Group;
                     return *this;
                 }
 
-                inline output_t operator*() const
+                inline iterator& operator--()
                 {
-                    const auto& transform = *Parent->Transform;
-                    return transform(*Pos, *OtherPos);
+                    --Group;
+                    return *this;
                 }
 
-                prev_iter_t Begin;
-                prev_iter_t End;
-                prev_iter_t Pos;
-
-                other_range_iter_t OtherBegin;
-                other_range_iter_t OtherEnd;
-                other_range_iter_t OtherPos;
-
-                const join_range* Parent;
-
-            private:
-                // Finds the next match in both ranges using the key selectors and == comparison.
-                void FindNext(bool preIncrementOther)
+                inline iterator& operator+=(std::ptrdiff_t n)
                 {
-                    const auto& keySelectorA = *Parent->KeySelectorA;
-                    const auto& keySelectorB = *Parent->KeySelectorB;
-
-                    if (preIncrementOther)
-                        ++OtherPos;
-
-                    while (Pos != End)
-                    {
-                        bool shouldContinue = true;
-                        const auto& keyA = keySelectorA(*Pos);
-
-                        while (OtherPos != OtherEnd)
-                        {
-                            const auto& keyB = keySelectorB(*OtherPos);
-
-                            if (keyA == keyB)
-                            {
-                                shouldContinue = false;
-                                break;
-                            }
-
-                            ++OtherPos;
-                        }
+                    Group += n;
+                    return *this;
+                }
 
-                        // Start over in the other range if it's finished.
-                        if (OtherPos == OtherEnd)
-                            OtherPos = OtherBegin;
+                inline std::ptrdiff_t operator-(const iterator& o) const
+                {
+                    return static_cast<std::ptrdiff_t>(Group - o.Group);
+                }
 
-                        if (!shouldContinue)
-                            break;
+                inline output_t operator*() const { return group_t(Parent, Group); }
+                inline output_t operator[](std::ptrdiff_t n) const { return group_t(Parent, Group + n); }
 
-                        ++Pos;
-                    }
-                }
+                const group_by_range* Parent;
+                size_t Group;
             };
 
         public:
-            join_range(
-                const TPrevRange& prev,
-                TOtherRange otherRange,
-                const TKeySelectorA& keySelectorA,
-                const TKeySelectorB& keySelectorB,
-                const TTransform& transform)
+            group_by_range() = default;
+
+            group_by_range(const TPrevRange& prev, const TKeySelector& keySelector)
                 : Prev(prev)
-                , OtherRange(otherRange)
-                , KeySelectorA(&keySelectorA)
-                , KeySelectorB(&keySelectorB)
-                , Transform(&transform)
+                , KeySelector(&keySelector)
             {}
 
             inline iterator begin() const
             {
-                return iterator(Prev.begin(), Prev.end(), this);
+                fill();
+                return iterator(this, 0);
+            }
+
+            // See fills_in_begin.
+            inline iterator filled_begin() const
+            {
+                return iterator(this, 0);
             }
 
             inline iterator end() const
             {
-                return iterator(Prev.end(), Prev.end(), this);
+                return iterator(this, Keys.size());
             }
 
-            TOtherRange OtherRange;
-            const TKeySelectorA* KeySelectorA;
-            const TKeySelectorB* KeySelectorB;
-            const TTransform* Transform;
+            inline range_size size_hint() const
+            {
+                return range_size::at_most(Prev.size_hint().Size);
+            }
 
-        private:
-            TPrevRange Prev;
-        };
+            inline const size_t* group_begin(size_t group) const
+            {
+                return Order.data() + Bounds[group];
+            }
 
-        // ----------------------------------
-        // order_by
-        // ----------------------------------
+            inline const size_t* group_end(size_t group) const
+            {
+                return Order.data() + Bounds[group + 1];
+            }
 
-        template<typename TPrevRange, typename TKeySelector>
-        class order_by_range : public base_range<
-            order_by_range<TPrevRange, TKeySelector>,
-            typename TPrevRange::iterator::output_t
-        >, public sorting_range
-        {
-        public:
-            using container_element_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
-            using container_t = std::vector<container_element_t>;
-            using container_iter_t = typename container_t::const_iterator;
+            inline const key_t& group_key(size_t group) const
+            {
+                return Keys.entries()[group].Key;
+            }
 
-        public:
-            struct iterator
+            inline element_output_t element(size_t index) const
             {
-                using output_t = typename container_iter_t::reference;
+                return storage::load(Values, index);
+            }
 
-                iterator() = default;
+        private:
+            using table_t = hash_table<key_t, size_t>;
 
-                iterator(container_iter_t pos)
-                    : Pos(pos)
-                {}
+            void fill() const
+            {
+                const auto& keySelector = *KeySelector;
+                const range_size size = Prev.size_hint();
+                std::vector<size_t> groupOf;
 
-                inline bool operator==(const iterator& o) const { return Pos == o.Pos; }
-                inline bool operator!=(const iterator& o) const { return Pos != o.Pos; }
+                Keys.clear();
+                Values.clear();
 
-                inline iterator& operator++()
+                if (size.IsExact)
                 {
-                    ++Pos;
-                    return *this;
+                    Values.reserve(size.Size);
+                    groupOf.reserve(size.Size);
                 }
 
-                inline output_t operator*() const
+                // Assign every element to the group of its key.
+                for (const auto& val : Prev)
                 {
-                    return *Pos;
-                }
+                    Values.push_back(storage::store(val));
 
-                container_iter_t Pos;
-            };
+                    const key_t key = keySelector(storage::load(Values, Values.size() - 1));
+                    groupOf.push_back(Keys.insert(key, table_t::hash_of(key), Keys.size()).first->Value);
+                }
 
-            order_by_range(const TPrevRange& prev, const TKeySelector& keySelector, sort_direction sortDir)
-                : Prev(prev)
-                , KeySelector(&keySelector)
-                , SortDirection(sortDir)
-            {}
+                // Count the elements of every group, and sort their indices by group.
+                Bounds.assign(Keys.size() + 1, 0);
 
-            inline iterator begin() const
-            {
-                SortedValues.clear();
-                for (const auto& val : Prev)
-                    SortedValues.push_back(val);
-                
-                std::sort(SortedValues.begin(), SortedValues.end(),
-                    [this](const container_element_t& a, const container_element_t& b)
-                {
-                    return this->compare_keys(a, b);
-                });
+                for (size_t group : groupOf)
+                    ++Bounds[group + 1];
 
-                return iterator(SortedValues.begin());
-            }
+                for (size_t i = 1; i < Bounds.size(); ++i)
+                    Bounds[i] += Bounds[i - 1];
 
-            inline iterator end() const
-            {
-                return iterator(SortedValues.end());
-            }
+                std::vector<size_t> next(Bounds.begin(), Bounds.end() - 1);
+                Order.resize(groupOf.size());
 
-            inline bool compare_keys(const container_element_t& a, const container_element_t& b) const
-            {
-                const auto& keySelector = *KeySelector;
-                const auto& aVal = keySelector(a);
-                const auto& bVal = keySelector(b);
-                
-                return (SortDirection == sort_direction::ascending)?
-                     (aVal < bVal) : /*descending:*/ (bVal < aVal);
+                for (size_t i = 0; i < groupOf.size(); ++i)
+                    Order[next[groupOf[i]]++] = i;
             }
 
-        private:
             TPrevRange Prev;
             const TKeySelector* KeySelector;
-            sort_direction SortDirection;
-            mutable container_t SortedValues;
-        };
 
-        // ----------------------------------
-        // then_by
-        // ----------------------------------
+            mutable table_t Keys;
+            mutable typename storage::container_t Values;
+            mutable std::vector<size_t> Order;
+            mutable std::vector<size_t> Bounds;
+        };
 
-        template<typename TPrevRange, typename TKeySelector>
-        class then_by_range : public base_range<
-            then_by_range<TPrevRange, TKeySelector>,
-            typename TPrevRange::iterator::output_t
-        >, public sorting_range
+        // Folds the elements of every key into an aggregate, in the order in which the keys
+        // first occur. Only the aggregates are stored, the elements are not.
+        // Without a seed, the first element of a key is its initial aggregate.
+        template<
+            typename TPrevRange, typename TKeySelector,
+            typename TAccumulate, typename TAccumFunc,
+            bool HasSeed
+        >
+        class group_aggregate_range : public base_range<
+            group_aggregate_range<TPrevRange, TKeySelector, TAccumulate, TAccumFunc, HasSeed>,
+            std::pair<typename group_by_traits<TPrevRange, TKeySelector>::key_t, TAccumulate>
+        >
         {
-            static_assert(std::is_assignable<sorting_range, TPrevRange>::value,
-                "A then_by operation can only be appended to another then_by or order_by operation."
-                );
-
         public:
-            using container_element_t = typename std::decay<typename TPrevRange::iterator::output_t>::type;
-            using container_t = std::vector<container_element_t>;
-            using container_iter_t = typename container_t::const_iterator;
+            using key_t = typename group_by_traits<TPrevRange, TKeySelector>::key_t;
+
+            static_assert(is_hashable<key_t>::value, "group_by requires keys that are supported by std::hash.");
+
+        private:
+            using table_t = hash_table<key_t, TAccumulate>;
+            using entry_iter_t = typename table_t::entry_container::const_iterator;
 
         public:
             struct iterator
             {
-                using output_t = typename container_iter_t::reference;
+                using output_t = std::pair<key_t, TAccumulate>;
+                using category = std::random_access_iterator_tag;
 
                 iterator() = default;
 
-                iterator(container_iter_t pos)
+                explicit iterator(entry_iter_t pos)
                     : Pos(pos)
                 {}
 
@@ -1504,61 +5367,92 @@ namespace linq
                     return *this;
                 }
 
-                inline output_t operator*() const
+                inline iterator& operator--()
                 {
-                    return *Pos;
+                    --Pos;
+                    return *this;
                 }
 
-                container_iter_t Pos;
+                inline iterator& operator+=(std::ptrdiff_t n)
+                {
+                    Pos += n;
+                    return *this;
+                }
+
+                inline std::ptrdiff_t operator-(const iterator& o) const { return Pos - o.Pos; }
+
+                inline output_t operator*() const { return output_t(Pos->Key, Pos->Value); }
+                inline output_t operator[](std::ptrdiff_t n) const { return output_t(Pos[n].Key, Pos[n].Value); }
+
+                entry_iter_t Pos;
             };
 
-            then_by_range(const TPrevRange& prev, const TKeySelector& keySelector, sort_direction sortDir)
+        public:
+            group_aggregate_range() = default;
+
+            group_aggregate_range(
+                const TPrevRange& prev,
+                const TKeySelector& keySelector,
+                const TAccumulate& seed,
+                const TAccumFunc& func)
                 : Prev(prev)
                 , KeySelector(&keySelector)
-                , SortDirection(sortDir)
+                , Seed(seed)
+                , Func(&func)
             {}
 
             inline iterator begin() const
             {
-                SortedValues.clear();
-                for (const auto& val : Prev)
-                    SortedValues.push_back(val);
+                const auto& keySelector = *KeySelector;
+                const auto& func = *Func;
 
-                std::sort(SortedValues.begin(), SortedValues.end(),
-                    [this](const container_element_t& a, const container_element_t& b)
+                Table.clear();
+
+                for (const auto& val : Prev)
                 {
-                    return this->compare_keys(a, b);
-                });
+                    const key_t key = keySelector(val);
+                    const size_t hash = table_t::hash_of(key);
+                    auto e = Table.find(key, hash);
+
+                    if (e != nullptr)
+                        e->Value = func(e->Value, val);
+                    else
+                        Table.insert(key, hash, initial(val, std::integral_constant<bool, HasSeed>()));
+                }
 
-                return iterator(SortedValues.begin());
+                return iterator(Table.entries().begin());
             }
 
             inline iterator end() const
             {
-                return iterator(SortedValues.end());
+                return iterator(Table.entries().end());
             }
 
-            inline bool compare_keys(const container_element_t& a, const container_element_t& b) const
+            inline range_size size_hint() const
             {
-                const auto& keySelector = *KeySelector;
-                const auto& aVal = keySelector(a);
-                const auto& bVal = keySelector(b);
-
-                if (Prev.compare_keys(a, b))
-                    return true;
-                else if (Prev.compare_keys(b, a))
-                    return false;
-                
-                return (SortDirection == sort_direction::ascending)?
-                     (aVal < bVal) : /*descending:*/ (bVal < aVal);
+                return range_size::at_most(Prev.size_hint().Size);
             }
 
         private:
+            template<typename TElement>
+            inline TAccumulate initial(const TElement& val, std::true_type) const
+            {
+                const auto& func = *Func;
+                return func(Seed, val);
+            }
+
+            template<typename TElement>
+            inline TAccumulate initial(const TElement& val, std::false_type) const
+            {
+                return val;
+            }
+
             TPrevRange Prev;
             const TKeySelector* KeySelector;
-            sort_direction SortDirection;
+            TAccumulate Seed;
+            const TAccumFunc* Func;
 
-            mutable container_t SortedValues;
+            mutable table_t Table;
         };
 
         // ----------------------------------
@@ -1599,6 +5493,9 @@ namespace linq
             {
                 using container_iter_t = typename TContainer::const_iterator;
                 using output_t = typename from_container_parent_range<TContainer>::iterator::output_t;
+                using category = range_category_t<
+                    typename std::iterator_traits<container_iter_t>::iterator_category
+                >;
 
                 iterator() = default;
 
@@ -1615,7 +5512,22 @@ namespace linq
                     return *this;
                 }
 
+                inline iterator& operator--()
+                {
+                    --Pos;
+                    return *this;
+                }
+
+                inline iterator& operator+=(std::ptrdiff_t n)
+                {
+                    Pos += n;
+                    return *this;
+                }
+
+                inline std::ptrdiff_t operator-(const iterator& o) const { return Pos - o.Pos; }
+
                 inline output_t operator*() const { return *Pos; }
+                inline output_t operator[](std::ptrdiff_t n) const { return Pos[n]; }
 
                 container_iter_t Pos;
             };
@@ -1625,20 +5537,52 @@ namespace linq
 
             explicit from_container_range(const TContainer* vec)
                 : Container(vec)
+                , Offset(0)
+                , Length(whole_container)
             {}
 
             inline iterator begin() const
             {
-                return iterator(Container->begin());
+                return iterator(std::next(Container->begin(), Offset));
             }
 
             inline iterator end() const
             {
-                return iterator(Container->end());
+                return (Length == whole_container) ?
+                    iterator(Container->end()) :
+                    iterator(std::next(Container->begin(), Offset + Length));
+            }
+
+            inline size_t size() const
+            {
+                return (Length == whole_container) ? Container->size() : Length;
+            }
+
+            inline range_size size_hint() const
+            {
+                return (Length == whole_container) ? container_size(*Container, 0) : range_size(Length, true);
+            }
+
+            // Restricts the range to the elements [first, last) (only for random access containers).
+            inline from_container_range slice(size_t first, size_t last) const
+            {
+                from_container_range ret(*this);
+                ret.Offset = Offset + first;
+                ret.Length = last - first;
+                return ret;
+            }
+
+            inline size_t slice_size() const
+            {
+                return size();
             }
 
         private:
+            static const size_t whole_container = static_cast<size_t>(-1);
+
             const TContainer* Container;
+            size_t Offset;
+            size_t Length;
         };
 
         // ----------------------------------
@@ -1652,19 +5596,19 @@ namespace linq
             struct iterator
             {
                 using output_t = T;
+                using category = std::random_access_iterator_tag;
 
                 iterator() = default;
 
-                iterator(const T& value, const T& bound, const T& step)
-                    : Index(0)
-                    , Start(value)
-                    , Value(value)
+                iterator(const T& start, const T& bound, const T& step, size_t index)
+                    : Index(index)
+                    , Start(start)
                     , Bound(bound)
                     , Step(step)
                 {}
 
-                inline bool operator==(const iterator& o) const { return Value == o.Value; }
-                inline bool operator!=(const iterator& o) const { return Value != o.Value; }
+                inline bool operator==(const iterator& o) const { return Index == o.Index; }
+                inline bool operator!=(const iterator& o) const { return Index != o.Index; }
 
                 inline iterator& operator++()
                 {
@@ -1672,24 +5616,44 @@ namespace linq
                     return *this;
                 }
 
-                inline output_t operator*() const
+                inline iterator& operator--()
+                {
+                    --Index;
+                    return *this;
+                }
+
+                inline iterator& operator+=(std::ptrdiff_t n)
+                {
+                    Index += n;
+                    return *this;
+                }
+
+                inline std::ptrdiff_t operator-(const iterator& o) const
+                {
+                    return static_cast<std::ptrdiff_t>(Index - o.Index);
+                }
+
+                inline output_t operator*() const { return value_at(Index); }
+                inline output_t operator[](std::ptrdiff_t n) const { return value_at(Index + n); }
+
+            private:
+                inline T value_at(size_t index) const
                 {
-                    Value = (Step * Index) + Start;
+                    T value = (Step * static_cast<T>(index)) + Start;
 
                     if (Step < T())
                     {
-                        if (Value < Bound)
-                            Value = Bound;
+                        if (value < Bound)
+                            value = Bound;
                     }
-                    else if (Value > Bound)
-                       Value = Bound;
+                    else if (value > Bound)
+                       value = Bound;
 
-                    return Value;
+                    return value;
                 }
 
-                int Index;
+                size_t Index;
                 T Start;
-                mutable T Value;
                 T Bound;
                 T Step;
             };
@@ -1706,22 +5670,55 @@ namespace linq
                 // Invert the step value if we're going backwards.
                 if (Start > End)
                     Step = -Step;
+
+                // The range ends with the first value that reaches the end (which is clamped to it).
+                if (Start == End)
+                    Count = 0;
+                else if (Step == T())
+                    Count = std::numeric_limits<size_t>::max();
+                else
+                {
+                    Count = static_cast<size_t>(std::ceil(
+                        static_cast<double>(End - Start) / static_cast<double>(Step))) + 1;
+
+                    // The division can be off by one for floating point values, so make the last
+                    // element the only one that equals the end.
+                    if (std::is_floating_point<T>::value)
+                    {
+                        while (Count > 1 && value_at(Count - 2) == End)
+                            --Count;
+
+                        while (value_at(Count - 1) != End)
+                            ++Count;
+                    }
+                }
             }
 
             inline iterator begin() const
             {
-                return iterator(Start, End, Step);
+                return iterator(Start, End, Step, 0);
             }
 
             inline iterator end() const
             {
-                return iterator(End, T(), T());
+                return iterator(Start, End, Step, Count);
+            }
+
+            inline range_size size_hint() const
+            {
+                return range_size(Count, true);
             }
 
         private:
+            inline T value_at(size_t index) const
+            {
+                return *iterator(Start, End, Step, index);
+            }
+
             T Start;
             T End;
             T Step;
+            size_t Count;
         };
 
         // ----------------------------------
@@ -1837,18 +5834,444 @@ namespace linq
                 : Generator(&generator)
             {}
 
-            inline iterator begin() const
+            inline iterator begin() const
+            {
+                return iterator(this, false);
+            }
+
+            inline iterator end() const
+            {
+                return iterator(this, true);
+            }
+
+        private:
+            const TGenerator* Generator;
+        };
+
+        // ----------------------------------
+        // Parallel reduction
+        // ----------------------------------
+
+        // Determines whether a range can be split into slices of its source, which is the
+        // case for random access containers that are optionally followed by where and select.
+        template<typename TRange>
+        struct is_sliceable : public std::false_type
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TContainer>
+        struct is_sliceable<from_container_range<TContainer>> : public std::is_base_of<
+            std::random_access_iterator_tag,
+            typename std::iterator_traits<typename TContainer::const_iterator>::iterator_category
+        >
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TPredicate>
+        struct is_sliceable<where_range<TPrevRange, TPredicate>> : public is_sliceable<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        template<typename TPrevRange, typename TTransform>
+        struct is_sliceable<select_range<TPrevRange, TTransform>> : public is_sliceable<TPrevRange>
+        {
+            /* Nothing to define here. */
+        };
+
+        // The smallest number of source elements that are reduced by one task.
+        static const size_t parallel_reduce_min_chunk = 32768;
+
+        // Splits a range into slices, reduces them with chunkFunc on multiple threads and
+        // combines the results in the order of the slices, so combineFunc only has to be associative.
+        template<typename TRange, typename TResult, typename TChunkFunc, typename TCombineFunc>
+        TResult parallel_reduce(
+            const TRange& range,
+            const TResult& identity,
+            const TChunkFunc& chunkFunc,
+            const TCombineFunc& combineFunc,
+            std::true_type)
+        {
+            const size_t size = range.slice_size();
+            const size_t chunkCount = (std::min)(
+                hardware_thread_count() * 4,
+                (size + parallel_reduce_min_chunk - 1) / parallel_reduce_min_chunk);
+
+            if (chunkCount <= 1)
+                return combineFunc(identity, chunkFunc(range));
+
+            // Wrapped, so that std::vector<bool> can't pack the results of different threads.
+            struct partial
+            {
+                TResult Value;
+            };
+
+            std::vector<partial> partials(chunkCount, partial{ identity });
+
+            parallel_for(chunkCount, [&](size_t i)
+            {
+                partials[i].Value = chunkFunc(range.slice(size * i / chunkCount, size * (i + 1) / chunkCount));
+            });
+
+            TResult result = identity;
+
+            for (const auto& p : partials)
+                result = combineFunc(result, p.Value);
+
+            return result;
+        }
+
+        // Ranges that can't be split are reduced on the calling thread.
+        template<typename TRange, typename TResult, typename TChunkFunc, typename TCombineFunc>
+        inline TResult parallel_reduce(
+            const TRange& range,
+            const TResult& identity,
+            const TChunkFunc& chunkFunc,
+            const TCombineFunc& combineFunc,
+            std::false_type)
+        {
+            return combineFunc(identity, chunkFunc(range));
+        }
+
+        // Aggregates the elements of a sliceable range by key on multiple threads. Every thread
+        // aggregates one slice into a table of its own. The entries of these tables are then
+        // bucketed by hash, and every bucket is merged into its own table, again in parallel.
+        template<typename TRange, typename TKeySelector, typename TAccumFunc>
+        std::vector<std::pair<
+            typename group_by_traits<TRange, TKeySelector>::key_t,
+            typename std::decay<typename TRange::iterator::output_t>::type
+        >>
+            parallel_aggregate_by(
+                const TRange& range,
+                const TKeySelector& keySelector,
+                const TAccumFunc& func,
+                std::true_type)
+        {
+            using key_t = typename group_by_traits<TRange, TKeySelector>::key_t;
+            using value_t = typename std::decay<typename TRange::iterator::output_t>::type;
+            using table_t = hash_table<key_t, value_t>;
+            using result_t = std::vector<std::pair<key_t, value_t>>;
+
+            const size_t size = range.slice_size();
+            const size_t chunkCount = (std::min)(
+                hardware_thread_count(),
+                (size + parallel_reduce_min_chunk - 1) / parallel_reduce_min_chunk);
+
+            if (chunkCount <= 1)
+                return range.group_by(keySelector, func).to_vector();
+
+            // Aggregate every slice into a table of its own.
+            std::vector<table_t> chunkTables(chunkCount);
+
+            parallel_for(chunkCount, [&](size_t c)
+            {
+                table_t& table = chunkTables[c];
+
+                for (const auto& val : range.slice(size * c / chunkCount, size * (c + 1) / chunkCount))
+                {
+                    const key_t key = keySelector(val);
+                    const size_t hash = table_t::hash_of(key);
+                    auto e = table.find(key, hash);
+
+                    if (e != nullptr)
+                        e->Value = func(e->Value, val);
+                    else
+                        table.insert(key, hash, val);
+                }
+            });
+
+            // Bucket the entries of every table by the upper half of their hash, because the lower
+            // bits choose the slots of the merged tables.
+            const size_t partitionCount = chunkCount;
+            const int halfBits = std::numeric_limits<size_t>::digits / 2;
+            std::vector<std::vector<std::vector<size_t>>> buckets(chunkCount);
+
+            parallel_for(chunkCount, [&](size_t c)
+            {
+                const auto& entries = chunkTables[c].entries();
+                buckets[c].resize(partitionCount);
+
+                for (size_t i = 0; i < entries.size(); ++i)
+                {
+                    const unsigned long long upper = entries[i].Hash >> halfBits;
+                    buckets[c][static_cast<size_t>((upper * partitionCount) >> halfBits)].push_back(i);
+                }
+            });
+
+            // Merge every bucket, visiting the tables in the order of their slices.
+            std::vector<table_t> merged(partitionCount);
+
+            parallel_for(partitionCount, [&](size_t p)
+            {
+                size_t count = 0;
+
+                for (size_t c = 0; c < chunkCount; ++c)
+                    count += buckets[c][p].size();
+
+                table_t& table = merged[p];
+                table.reserve(count);
+
+                for (size_t c = 0; c < chunkCount; ++c)
+                {
+                    const auto& entries = chunkTables[c].entries();
+
+                    for (size_t i : buckets[c][p])
+                    {
+                        const auto& src = entries[i];
+                        auto e = table.find(src.Key, src.Hash);
+
+                        if (e != nullptr)
+                            e->Value = func(e->Value, src.Value);
+                        else
+                            table.insert(src.Key, src.Hash, src.Value);
+                    }
+                }
+            });
+
+            size_t total = 0;
+
+            for (const auto& table : merged)
+                total += table.size();
+
+            result_t result;
+            result.reserve(total);
+
+            for (const auto& table : merged)
+                for (const auto& e : table.entries())
+                    result.emplace_back(e.Key, e.Value);
+
+            return result;
+        }
+
+        template<typename TRange, typename TKeySelector, typename TAccumFunc>
+        inline std::vector<std::pair<
+            typename group_by_traits<TRange, TKeySelector>::key_t,
+            typename std::decay<typename TRange::iterator::output_t>::type
+        >>
+            parallel_aggregate_by(
+                const TRange& range,
+                const TKeySelector& keySelector,
+                const TAccumFunc& func,
+                std::false_type)
+        {
+            return range.group_by(keySelector, func).to_vector();
+        }
+
+        // Moves the chunk buffers into one vector, each to its offset, on multiple threads.
+        // std::vector can't be sized without constructing its elements, so they are default
+        // constructed first and then assigned: one extra pass over the result, which is a
+        // memset for trivial types and cheap for most others (such as std::string).
+        template<typename T>
+        std::vector<T> parallel_concat(std::vector<std::vector<T>>& buffers, const std::vector<size_t>& offsets, size_t total, std::true_type)
+        {
+            std::vector<T> ret(total);
+
+            parallel_for(buffers.size(), [&](size_t i)
+            {
+                std::move(buffers[i].begin(), buffers[i].end(), ret.begin() + offsets[i]);
+            });
+
+            return ret;
+        }
+
+        // Elements that can't be default constructed are appended on the calling thread, and so
+        // are bools, since threads would write to shared words of the packed std::vector<bool>.
+        template<typename T>
+        std::vector<T> parallel_concat(std::vector<std::vector<T>>& buffers, const std::vector<size_t>&, size_t total, std::false_type)
+        {
+            std::vector<T> ret;
+            ret.reserve(total);
+
+            for (auto& b : buffers)
+                std::move(b.begin(), b.end(), std::back_inserter(ret));
+
+            return ret;
+        }
+
+        // Copies the elements of a sliceable range into a vector on multiple threads, in the
+        // order of the range. Every thread fills a buffer of its own from one slice. The
+        // exclusive prefix sum of the buffer sizes then gives each buffer its offset in the
+        // result, which is allocated once and filled in parallel.
+        template<typename TRange>
+        std::vector<typename std::decay<typename TRange::iterator::output_t>::type>
+            parallel_to_vector(const TRange& range, std::true_type)
+        {
+            using output_t = typename std::decay<typename TRange::iterator::output_t>::type;
+
+            const size_t size = range.slice_size();
+            const size_t chunkCount = (std::min)(
+                hardware_thread_count() * 4,
+                (size + parallel_reduce_min_chunk - 1) / parallel_reduce_min_chunk);
+
+            if (chunkCount <= 1)
+                return range.to_vector();
+
+            std::vector<std::vector<output_t>> buffers(chunkCount);
+
+            parallel_for(chunkCount, [&](size_t i)
+            {
+                buffers[i] = range.slice(size * i / chunkCount, size * (i + 1) / chunkCount).to_vector();
+            });
+
+            std::vector<size_t> offsets(chunkCount);
+            size_t total = 0;
+
+            for (size_t i = 0; i < chunkCount; ++i)
+            {
+                offsets[i] = total;
+                total += buffers[i].size();
+            }
+
+            return parallel_concat(buffers, offsets, total, std::integral_constant<bool,
+                !std::is_same<output_t, bool>::value &&
+                std::is_default_constructible<output_t>::value &&
+                std::is_move_assignable<output_t>::value>());
+        }
+
+        template<typename TRange>
+        inline std::vector<typename std::decay<typename TRange::iterator::output_t>::type>
+            parallel_to_vector(const TRange& range, std::false_type)
+        {
+            return range.to_vector();
+        }
+
+        // ----------------------------------
+        // parallel
+        // ----------------------------------
+
+        // Runs the terminals of a range on multiple threads (see base_range::parallel()).
+        // Sliceable ranges (see is_sliceable) are split into blocks of source elements that are
+        // distributed by work_stealing_for, other ranges are enumerated on the calling thread.
+        template<typename TRange>
+        class parallel_range
+        {
+        public:
+            using output_t = typename std::decay<typename TRange::iterator::output_t>::type;
+
+            explicit parallel_range(const TRange& range)
+                : Range(range)
+            {}
+
+            // Returns the elements in the order of the range (see parallel_to_vector).
+            std::vector<output_t> to_vector() const
+            {
+                return parallel_to_vector(Range, is_sliceable<TRange>());
+            }
+
+            size_t count() const
+            {
+                std::atomic<size_t> ret(0);
+
+                run([&](const TRange& slice, size_t)
+                {
+                    ret += slice.count();
+                    return true;
+                });
+
+                return ret;
+            }
+
+            template<typename TPredicate>
+            size_t count(const TPredicate& predicate) const
+            {
+                std::atomic<size_t> ret(0);
+
+                run([&](const TRange& slice, size_t)
+                {
+                    ret += slice.count(predicate);
+                    return true;
+                });
+
+                return ret;
+            }
+
+            // Stops all threads as soon as one of them finds a match.
+            template<typename TPredicate>
+            bool any(const TPredicate& predicate) const
+            {
+                return find_first(predicate, true);
+            }
+
+            // Stops all threads as soon as one of them finds a mismatch.
+            template<typename TPredicate>
+            bool all(const TPredicate& predicate) const
+            {
+                return !find_first(predicate, false);
+            }
+
+            // Calls func for every element, concurrently and in no particular order.
+            template<typename TFunc>
+            void for_each(const TFunc& func) const
+            {
+                run([&](const TRange& slice, size_t)
+                {
+                    for (const auto& p : slice)
+                        func(p);
+
+                    return true;
+                });
+            }
+
+        private:
+            // The number of source elements in a block: small enough to balance expensive
+            // predicates, large enough to make the scheduling overhead negligible.
+            static const size_t max_block_size = 1024;
+
+            // Calls func(slice, firstIndex) for the blocks of the range until it returns false.
+            template<typename TFunc>
+            inline void run(const TFunc& func) const
+            {
+                run(func, is_sliceable<TRange>());
+            }
+
+            template<typename TFunc>
+            void run(const TFunc& func, std::true_type) const
+            {
+                const size_t size = Range.slice_size();
+                const size_t grain = (std::max)(size_t(1),
+                    (std::min)(size_t(max_block_size), size / (hardware_thread_count() * 8)));
+
+                work_stealing_for(size, grain, [&](size_t first, size_t last)
+                {
+                    return func(Range.slice(first, last), first);
+                });
+            }
+
+            template<typename TFunc>
+            inline void run(const TFunc& func, std::false_type) const
             {
-                return iterator(this, false);
+                func(Range, 0);
             }
 
-            inline iterator end() const
+            // Returns whether an element satisfies predicate == expected.
+            template<typename TPredicate>
+            bool find_first(const TPredicate& predicate, bool expected) const
             {
-                return iterator(this, true);
+                std::atomic<bool> found(false);
+
+                run([&](const TRange& slice, size_t)
+                {
+                    for (const auto& p : slice)
+                    {
+                        if (found.load(std::memory_order_relaxed))
+                            return false;
+
+                        if (static_cast<bool>(predicate(p)) == expected)
+                        {
+                            found = true;
+                            return false;
+                        }
+                    }
+
+                    return true;
+                });
+
+                return found;
             }
 
-        private:
-            const TGenerator* Generator;
+            TRange Range;
         };
 
         // ----------------------------------
@@ -1870,6 +6293,38 @@ namespace linq
             return distinct_range<TMy>(static_cast<const TMy&>(*this));
         }
 
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector>
+        inline distinct_by_range<TMy, TKeySelector>
+            base_range<TMy, TOutput>::distinct_by(const TKeySelector& keySelector) const
+        {
+            return distinct_by_range<TMy, TKeySelector>(static_cast<const TMy&>(*this), keySelector);
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TOtherRange>
+        inline union_range<TMy, TOtherRange>
+            base_range<TMy, TOutput>::union_with(const TOtherRange& otherRange) const
+        {
+            return union_range<TMy, TOtherRange>(static_cast<const TMy&>(*this), otherRange);
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TOtherRange>
+        inline intersect_range<TMy, TOtherRange>
+            base_range<TMy, TOutput>::intersect(const TOtherRange& otherRange) const
+        {
+            return intersect_range<TMy, TOtherRange>(static_cast<const TMy&>(*this), otherRange);
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TOtherRange>
+        inline except_range<TMy, TOtherRange>
+            base_range<TMy, TOutput>::except(const TOtherRange& otherRange) const
+        {
+            return except_range<TMy, TOtherRange>(static_cast<const TMy&>(*this), otherRange);
+        }
+
         template<typename TMy, typename TOutput>
         template<typename TTransform>
         inline select_range<TMy, TTransform>
@@ -1923,6 +6378,20 @@ namespace linq
             return skip_while_range<TMy, TPredicate>(static_cast<const TMy&>(*this), predicate);
         }
 
+        template<typename TMy, typename TOutput>
+        inline chunk_range<TMy>
+            base_range<TMy, TOutput>::chunk(size_t chunkSize) const
+        {
+            return chunk_range<TMy>(static_cast<const TMy&>(*this), chunkSize);
+        }
+
+        template<typename TMy, typename TOutput>
+        inline buffered_range<TMy>
+            base_range<TMy, TOutput>::buffered(size_t capacity) const
+        {
+            return buffered_range<TMy>(static_cast<const TMy&>(*this), capacity);
+        }
+
         template<typename TMy, typename TOutput>
         template<typename TOtherRange>
         inline append_range<TMy, TOtherRange>
@@ -1957,6 +6426,25 @@ namespace linq
                 );
         }
 
+        template<typename TMy, typename TOutput>
+        template<typename TOtherRange, typename TKeySelectorA, typename TKeySelectorB, typename TTransform>
+        inline merge_join_range<TMy, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform>
+            base_range<TMy, TOutput>::merge_join(
+                const TOtherRange& otherRange,
+                const TKeySelectorA& keySelectorA,
+                const TKeySelectorB& keySelectorB,
+                const TTransform& transform
+                ) const
+        {
+            return merge_join_range<TMy, TOtherRange, TKeySelectorA, TKeySelectorB, TTransform>(
+                static_cast<const TMy&>(*this),
+                otherRange,
+                keySelectorA,
+                keySelectorB,
+                transform
+                );
+        }
+
         template<typename TMy, typename TOutput>
         template<typename TKeySelector>
         inline order_by_range<TMy, TKeySelector> base_range<TMy, TOutput>::order_by(
@@ -1967,10 +6455,57 @@ namespace linq
             return order_by_range<TMy, TKeySelector>(
                 static_cast<const TMy&>(*this),
                 keySelector,
-                sortDir
+                sortDir,
+                false
+                );
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector>
+        inline order_by_range<TMy, TKeySelector> base_range<TMy, TOutput>::order_by(
+            const TKeySelector& keySelector,
+            sort_direction sortDir,
+            parallel_policy
+            ) const
+        {
+            return order_by_range<TMy, TKeySelector>(
+                static_cast<const TMy&>(*this),
+                keySelector,
+                sortDir,
+                true
+                );
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector>
+        inline order_by_external_range<TMy, TKeySelector> base_range<TMy, TOutput>::order_by_external(
+            const TKeySelector& keySelector,
+            sort_direction sortDir,
+            size_t memoryBudget,
+            const std::string& tempDirectory
+            ) const
+        {
+            return order_by_external_range<TMy, TKeySelector>(
+                static_cast<const TMy&>(*this),
+                keySelector,
+                sortDir,
+                memoryBudget,
+                tempDirectory
                 );
         }
 
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector>
+        inline take_range<order_by_range<TMy, TKeySelector>> base_range<TMy, TOutput>::top_k(
+            size_t count,
+            const TKeySelector& keySelector,
+            sort_direction sortDir
+            ) const
+        {
+            // take_range recognizes the sorting range and only sorts the first count elements.
+            return order_by(keySelector, sortDir).take(count);
+        }
+
         template<typename TMy, typename TOutput>
         template<typename TKeySelector>
         inline then_by_range<TMy, TKeySelector> base_range<TMy, TOutput>::then_by(
@@ -1985,9 +6520,80 @@ namespace linq
                 );
         }
 
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector>
+        inline group_by_range<TMy, TKeySelector> base_range<TMy, TOutput>::group_by(
+            const TKeySelector& keySelector
+            ) const
+        {
+            return group_by_range<TMy, TKeySelector>(static_cast<const TMy&>(*this), keySelector);
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector, typename TAccumFunc>
+        inline group_aggregate_range<TMy, TKeySelector, typename base_range<TMy, TOutput>::output_t, TAccumFunc, false>
+            base_range<TMy, TOutput>::group_by(
+                const TKeySelector& keySelector,
+                const TAccumFunc& aggregator
+                ) const
+        {
+            return group_aggregate_range<TMy, TKeySelector, output_t, TAccumFunc, false>(
+                static_cast<const TMy&>(*this),
+                keySelector,
+                output_t(),
+                aggregator
+                );
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector, typename TAccumulate, typename TAccumFunc>
+        inline group_aggregate_range<TMy, TKeySelector, TAccumulate, TAccumFunc, true>
+            base_range<TMy, TOutput>::group_by(
+                const TKeySelector& keySelector,
+                const TAccumulate& seed,
+                const TAccumFunc& aggregator
+                ) const
+        {
+            return group_aggregate_range<TMy, TKeySelector, TAccumulate, TAccumFunc, true>(
+                static_cast<const TMy&>(*this),
+                keySelector,
+                seed,
+                aggregator
+                );
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TKeySelector, typename TAccumFunc>
+        inline std::vector<std::pair<
+            typename group_by_traits<TMy, TKeySelector>::key_t,
+            typename base_range<TMy, TOutput>::output_t
+        >>
+            base_range<TMy, TOutput>::aggregate_by(
+                const TKeySelector& keySelector,
+                const TAccumFunc& aggregator,
+                parallel_policy
+                ) const
+        {
+            return parallel_aggregate_by(static_cast<const TMy&>(*this), keySelector, aggregator, is_sliceable<TMy>());
+        }
+
         template<typename TMy, typename TOutput>
         inline typename base_range<TMy, TOutput>::output_t
             base_range<TMy, TOutput>::sum() const
+        {
+            return sum(is_simd_reducible<TMy>());
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::sum(std::true_type) const
+        {
+            return simd_reduce_range<simd_op::sum>(static_cast<const TMy&>(*this));
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::sum(std::false_type) const
         {
             bool first = true;
             output_t sum = output_t();
@@ -2009,6 +6615,20 @@ namespace linq
         template<typename TMy, typename TOutput>
         inline typename base_range<TMy, TOutput>::output_t
             base_range<TMy, TOutput>::min() const
+        {
+            return min(is_simd_reducible<TMy>());
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::min(std::true_type) const
+        {
+            return simd_reduce_range<simd_op::min>(static_cast<const TMy&>(*this));
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::min(std::false_type) const
         {
             bool first = true;
             output_t min = output_t();
@@ -2030,6 +6650,20 @@ namespace linq
         template<typename TMy, typename TOutput>
         inline typename base_range<TMy, TOutput>::output_t
             base_range<TMy, TOutput>::max() const
+        {
+            return max(is_simd_reducible<TMy>());
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::max(std::true_type) const
+        {
+            return simd_reduce_range<simd_op::max>(static_cast<const TMy&>(*this));
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::max(std::false_type) const
         {
             bool first = true;
             output_t max = output_t();
@@ -2052,7 +6686,53 @@ namespace linq
         inline typename avg_calculator<TMy, typename base_range<TMy, TOutput>::output_t>::output_t
             base_range<TMy, TOutput>::average() const
         {
-            return avg_calculator<TMy, output_t>().calc(static_cast<const TMy&>(*this));
+            const TMy& range = static_cast<const TMy&>(*this);
+            const range_size size = range.size_hint();
+
+            // If the number of elements is known, only the sum has to be computed.
+            if (size.IsExact)
+                return avg_calculator<TMy, output_t>().calc(sum(), size.Size);
+
+            return stats().Mean;
+        }
+
+        template<typename TMy, typename TOutput>
+        inline range_stats<
+            typename base_range<TMy, TOutput>::output_t,
+            typename avg_calculator<TMy, typename base_range<TMy, TOutput>::output_t>::output_t
+        >
+            base_range<TMy, TOutput>::stats() const
+        {
+            range_stats<output_t, typename avg_calculator<TMy, output_t>::output_t> ret;
+            ret.Count = 0;
+            ret.Sum = output_t();
+            ret.Min = output_t();
+            ret.Max = output_t();
+
+            for (const auto& p : static_cast<const TMy&>(*this))
+            {
+                if (ret.Count == 0)
+                {
+                    ret.Sum = p;
+                    ret.Min = p;
+                    ret.Max = p;
+                }
+                else
+                {
+                    ret.Sum += p;
+
+                    if (p < ret.Min)
+                        ret.Min = p;
+
+                    if (ret.Max < p)
+                        ret.Max = p;
+                }
+
+                ++ret.Count;
+            }
+
+            ret.Mean = avg_calculator<TMy, output_t>().calc(ret.Sum, ret.Count);
+            return ret;
         }
 
         template<typename TMy, typename TOutput>
@@ -2077,6 +6757,96 @@ namespace linq
             return sum;
         }
 
+        template<typename TMy, typename TOutput>
+        template<typename TResult, typename TAccumFunc, typename TCombineFunc>
+        inline TResult base_range<TMy, TOutput>::aggregate_parallel(
+            const TResult& identity,
+            const TAccumFunc& func,
+            const TCombineFunc& combine) const
+        {
+            auto chunk = [&](const TMy& slice) -> TResult
+            {
+                TResult acc = identity;
+
+                for (const auto& p : slice)
+                    acc = func(acc, p);
+
+                return acc;
+            };
+
+            return parallel_reduce(static_cast<const TMy&>(*this), identity, chunk, combine, is_sliceable<TMy>());
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::sum(parallel_policy) const
+        {
+            return reduce_parallel<simd_op::sum>();
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::min(parallel_policy) const
+        {
+            return reduce_parallel<simd_op::min>();
+        }
+
+        template<typename TMy, typename TOutput>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::max(parallel_policy) const
+        {
+            return reduce_parallel<simd_op::max>();
+        }
+
+        template<typename TMy, typename TOutput>
+        template<simd_op Op>
+        typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::reduce_parallel() const
+        {
+            // Chunks without elements must not contribute to the result.
+            struct partial
+            {
+                bool HasValue;
+                output_t Value;
+            };
+
+            auto chunk = [](const TMy& slice) -> partial
+            {
+                auto begin = slice.begin();
+
+                if (begin == slice.end())
+                    return partial{ false, output_t() };
+
+                return partial{ true,
+                    (Op == simd_op::sum) ? slice.sum() :
+                    (Op == simd_op::min) ? slice.min() :
+                    slice.max() };
+            };
+
+            auto combine = [](partial a, const partial& b) -> partial
+            {
+                if (!b.HasValue)
+                    return a;
+
+                if (!a.HasValue)
+                    return b;
+
+                if (Op == simd_op::sum)
+                    a.Value += b.Value;
+                else if (Op == simd_op::min ? (b.Value < a.Value) : (a.Value < b.Value))
+                    a.Value = b.Value;
+
+                return a;
+            };
+
+            return parallel_reduce(
+                static_cast<const TMy&>(*this),
+                partial{ false, output_t() },
+                chunk,
+                combine,
+                is_sliceable<TMy>()).Value;
+        }
+
         template<typename TMy, typename TOutput>
         inline typename base_range<TMy, TOutput>::output_t
             base_range<TMy, TOutput>::first(const output_t& defaultValue) const
@@ -2103,14 +6873,38 @@ namespace linq
         inline typename base_range<TMy, TOutput>::output_t
             base_range<TMy, TOutput>::last(const output_t& defaultValue) const
         {
-            output_t ret = defaultValue;
+            const TMy& range = static_cast<const TMy&>(*this);
+            auto begin = range.begin();
+            auto end = range.end();
 
-            for (const auto& p : static_cast<const TMy&>(*this))
-                ret = p;
+            if (begin == end)
+                return defaultValue;
+
+            // Bidirectional iterators step back from the end, instead of visiting everything.
+            return last_of(begin, end, is_bidirectional_iterator<decltype(begin)>());
+        }
+
+        template<typename TMy, typename TOutput>
+        template<typename TIter>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::last_of(TIter begin, const TIter& end, std::false_type)
+        {
+            output_t ret = *begin;
+
+            for (++begin; begin != end; ++begin)
+                ret = *begin;
 
             return ret;
         }
 
+        template<typename TMy, typename TOutput>
+        template<typename TIter>
+        inline typename base_range<TMy, TOutput>::output_t
+            base_range<TMy, TOutput>::last_of(const TIter&, TIter end, std::true_type)
+        {
+            return *--end;
+        }
+
         template<typename TMy, typename TOutput>
         template<typename TPredicate>
         inline typename base_range<TMy, TOutput>::output_t
@@ -2150,12 +6944,15 @@ namespace linq
         template<typename TMy, typename TOutput>
         size_t base_range<TMy, TOutput>::count() const
         {
-            size_t ret = 0;
+            const TMy& range = static_cast<const TMy&>(*this);
+            const range_size size = range.size_hint();
 
-            for (const auto& p : static_cast<const TMy&>(*this))
-                ++ret;
+            if (size.IsExact)
+                return size.Size;
 
-            return ret;
+            auto begin = range.begin();
+
+            return iterator_distance(begin, range.end());
         }
 
         template<typename TMy, typename TOutput>
@@ -2171,35 +6968,59 @@ namespace linq
             return ret;
         }
 
+        template<typename TMy, typename TOutput>
+        template<typename TPredicate>
+        size_t base_range<TMy, TOutput>::count(const TPredicate& predicate, parallel_policy) const
+        {
+            auto chunk = [&](const TMy& slice) { return slice.count(predicate); };
+            auto combine = [](size_t a, size_t b) { return a + b; };
+
+            return parallel_reduce(static_cast<const TMy&>(*this), size_t(0), chunk, combine, is_sliceable<TMy>());
+        }
+
         template<typename TMy, typename TOutput>
         inline typename base_range<TMy, TOutput>::output_t
             base_range<TMy, TOutput>::element_at(size_t index, const output_t& defaultValue) const
         {
-            size_t i = 0;
-
-            for (const auto& p : static_cast<const TMy&>(*this))
-            {
-                if (i >= index)
-                    return p;
+            const TMy& range = static_cast<const TMy&>(*this);
+            auto begin = range.begin();
+            auto end = range.end();
 
-                ++i;
-            }
+            iterator_advance(begin, end, index);
 
-            return defaultValue;
+            return (begin != end) ? *begin : defaultValue;
         }
 
         template<typename TMy, typename TOutput>
         inline std::vector<typename base_range<TMy, TOutput>::output_t>
             base_range<TMy, TOutput>::to_vector() const
         {
+            const TMy& range = static_cast<const TMy&>(*this);
+            const range_size size = range.size_hint();
             std::vector<output_t> vec;
 
-            for (const auto& p : static_cast<const TMy&>(*this))
+            if (size.IsExact)
+                vec.reserve(size.Size);
+
+            for (const auto& p : range)
                 vec.push_back(p);
 
             return vec;
         }
 
+        template<typename TMy, typename TOutput>
+        inline std::vector<typename base_range<TMy, TOutput>::output_t>
+            base_range<TMy, TOutput>::to_vector(parallel_policy) const
+        {
+            return parallel_to_vector(static_cast<const TMy&>(*this), is_sliceable<TMy>());
+        }
+
+        template<typename TMy, typename TOutput>
+        inline parallel_range<TMy> base_range<TMy, TOutput>::parallel() const
+        {
+            return parallel_range<TMy>(static_cast<const TMy&>(*this));
+        }
+
     } // end namespace details
 
     template<typename TContainer>